@@ -0,0 +1,65 @@
+#!/bin/sh
+# Launches pen RUNS times with a hidden window and reports p50/p95 time to
+# first frame, as printed by --startup-report.
+#
+#   cold: every launch starts with an empty font atlas cache (and, when run as
+#         root, with the page cache dropped)
+#   warm: every launch reuses a cache populated by a first, discarded launch
+#
+# Without a display the runs go through xvfb-run when it is available.
+set -eu
+
+RUNS=${1:-20}
+PEN=${2:-./pen}
+
+if [ -z "${DISPLAY:-}${WAYLAND_DISPLAY:-}" ] && [ -z "${PEN_BENCH_XVFB:-}" ]; then
+    if command -v xvfb-run >/dev/null 2>&1; then
+        PEN_BENCH_XVFB=1 exec xvfb-run -a sh "$0" "$RUNS" "$PEN"
+    fi
+    echo "bench_startup: no display and no xvfb-run" >&2
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT INT TERM
+
+# The state dir is scratch too, so no launch restores (or overwrites) the
+# user's session.
+launch() {
+    XDG_CACHE_HOME=$1 XDG_STATE_HOME=$1 "$PEN" --startup-report --hidden --quit-after-first-frame 2>&1 >/dev/null |
+        awk '$1 == "total" { print $2 }'
+}
+
+drop_caches() {
+    sync
+    [ -w /proc/sys/vm/drop_caches ] && echo 3 > /proc/sys/vm/drop_caches || true
+}
+
+# Prints "p50 p95" of the numbers in file $1.
+percentiles() {
+    sort -n "$1" | awk '{ v[NR] = $1 }
+        END {
+            i50 = int((NR * 50 + 99) / 100); i95 = int((NR * 95 + 99) / 100)
+            printf "p50 %8.2f ms   p95 %8.2f ms   (n=%d)\n", v[i50], v[i95], NR
+        }'
+}
+
+i=0
+while [ "$i" -lt "$RUNS" ]; do
+    rm -rf "$WORK/cold"
+    mkdir -p "$WORK/cold"
+    drop_caches
+    launch "$WORK/cold" >> "$WORK/cold.txt"
+    i=$((i + 1))
+done
+
+mkdir -p "$WORK/warm"
+launch "$WORK/warm" > /dev/null
+i=0
+while [ "$i" -lt "$RUNS" ]; do
+    launch "$WORK/warm" >> "$WORK/warm.txt"
+    i=$((i + 1))
+done
+
+printf "cold  "; percentiles "$WORK/cold.txt"
+printf "warm  "; percentiles "$WORK/warm.txt"
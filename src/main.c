@@ -15,24 +15,199 @@
  * along with this program; if not, see the file COPYING.
  */
 
+#define _GNU_SOURCE
+
 #include "raylib.h"
+#include "rlgl.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <strings.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
 
 #include "tinyfiledialogs.h"
 
+// Row -> byte offset table, kept in step with every edit so row lookups never
+// rescan the text. Shifting the tail after an edit is deferred: rows >= shiftFrom
+// are stale by shiftBy, and the pending window only moves when edits move.
+typedef struct {
+    int *starts;
+    int count;
+    int cap;
+    int shiftFrom;
+    int shiftBy;
+} LineIndex;
+
+// Each undo step holds the bytes one edit removed and inserted at an offset.
+// An edit of a mergeable kind that carries on exactly where the newest step
+// left off extends that step instead of pushing another; typing does so only
+// within a word, without a pause.
+// An UNDO_SWAP step holds a whole other version of the text (in bytes, with
+// its line index); undo and redo exchange it with the buffer's.
+typedef enum { UNDO_EDIT, UNDO_TYPING, UNDO_DELETE, UNDO_SWAP } UndoKind;
+
+typedef struct {
+    UndoKind kind;
+    int at;
+    char *bytes;
+    int removedLen, insertedLen;
+    int cursorBefore, cursorAfter;
+    LineIndex lines;
+    // A batch step (one edit at many cursors) keeps (at, removedLen,
+    // insertedLen) per span in spans, offsets as before the batch, and each
+    // span's removed then inserted bytes back to back in bytes.
+    int *spans;
+    int spanCount;
+} UndoStep;
+
+#define UNDO_MAX_STEPS 1000
+#define UNDO_TYPING_GAP 1.0     // seconds of no typing that end a typing step
+
+typedef struct {
+    UndoStep *steps;
+    int count, cap;
+    int pos;
+    double typedAt;     // when typing was last recorded
+} UndoStack;
+
 typedef struct {
     char *data;
     int len;
     int cap;
     int cursor;
+    LineIndex lines;
+    UndoStack undo;
+    // Rows touched by edits since the last buf_take_touched(), [touchA, touchZ).
+    // touchZ == INT_MAX means every row from touchA on moved. The last
+    // touchTail rows are old rows left alone, only shifted.
+    int touchA, touchZ, touchTail;
+    // Bumped on every change, so caches of the text can tell they are stale.
+    unsigned version;
 } Buffer;
 
 static int clampi(int v, int lo, int hi) { if (v < lo) return lo; if (v > hi) return hi; return v; }
 static int mini(int a, int b) { return a < b ? a : b; }
 static int maxi(int a, int b) { return a > b ? a : b; }
+static float clampf(float v, float lo, float hi) { if (v < lo) return lo; if (v > hi) return hi; return v; }
+
+static bool li_reserve(LineIndex *li, int needed) {
+    if (needed <= li->cap) return true;
+    int newcap = li->cap ? li->cap : 256;
+    while (newcap < needed) newcap *= 2;
+    int *p = (int*)realloc(li->starts, sizeof(int) * (size_t)newcap);
+    if (!p) return false;
+    li->starts = p;
+    li->cap = newcap;
+    return true;
+}
+
+static void li_init(LineIndex *li) {
+    li->starts = NULL;
+    li->count = li->cap = 0;
+    li->shiftFrom = li->shiftBy = 0;
+    if (li_reserve(li, 256)) { li->starts[0] = 0; li->count = 1; }
+}
+static void li_free(LineIndex *li) { free(li->starts); li->starts = NULL; li->count = li->cap = 0; li->shiftFrom = li->shiftBy = 0; }
+
+static void li_flush(LineIndex *li) {
+    if (li->shiftBy == 0) return;
+    for (int i = li->shiftFrom; i < li->count; i++) li->starts[i] += li->shiftBy;
+    li->shiftBy = 0;
+}
+
+static int li_start(const LineIndex *li, int row) {
+    int v = li->starts[row];
+    return (row >= li->shiftFrom) ? v + li->shiftBy : v;
+}
+
+// Adds `by` to every row >= from. Only the rows between the old and new
+// pending boundary are touched, so edits that stay on one row are O(1).
+static void li_shift(LineIndex *li, int from, int by) {
+    if (by == 0 || from >= li->count) return;
+    if (li->shiftBy == 0) { li->shiftFrom = from; li->shiftBy = by; return; }
+    if (from < li->shiftFrom) {
+        for (int i = from; i < li->shiftFrom; i++) li->starts[i] += by;
+    } else {
+        for (int i = li->shiftFrom; i < from; i++) li->starts[i] += li->shiftBy;
+        li->shiftFrom = from;
+    }
+    li->shiftBy += by;
+}
+
+// Applies the pending shift to rows below `row`, so they can be written
+// directly.
+static void li_settle(LineIndex *li, int row) {
+    if (li->shiftBy == 0 || li->shiftFrom >= row) return;
+    for (int i = li->shiftFrom; i < row && i < li->count; i++) li->starts[i] += li->shiftBy;
+    li->shiftFrom = row;
+}
+
+static void li_rebuild(LineIndex *li, const char *data, int len) {
+    li->count = 1;
+    li->shiftFrom = li->shiftBy = 0;
+    const char *p = data, *end = data + len;
+    while (p < end) {
+        const char *nl = (const char*)memchr(p, '\n', (size_t)(end - p));
+        if (!nl) break;
+        if (!li_reserve(li, li->count + 1)) return;
+        li->starts[li->count++] = (int)(nl - data) + 1;
+        p = nl + 1;
+    }
+}
+
+// Last row whose start is <= pos.
+static int li_row_of(const LineIndex *li, int pos) {
+    int lo = 0, hi = li->count - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (li_start(li, mid) <= pos) lo = mid; else hi = mid - 1;
+    }
+    return lo;
+}
+
+static void li_on_insert(LineIndex *li, int pos, const char *s, int n) {
+    int row = li_row_of(li, pos);
+    int k = 0;
+    for (const char *p = s, *end = s + n; (p = (const char*)memchr(p, '\n', (size_t)(end - p))) != NULL; p++) k++;
+
+    if (k == 0) { li_shift(li, row + 1, n); return; }
+    if (!li_reserve(li, li->count + k)) return;
+
+    li_flush(li);
+    memmove(li->starts + row + 1 + k, li->starts + row + 1, sizeof(int) * (size_t)(li->count - row - 1));
+    int r = row + 1;
+    for (const char *p = s, *end = s + n; (p = (const char*)memchr(p, '\n', (size_t)(end - p))) != NULL; p++)
+        li->starts[r++] = pos + (int)(p - s) + 1;
+    li->count += k;
+    li_shift(li, row + 1 + k, n);
+}
+
+static void li_on_delete(LineIndex *li, int a, int z) {
+    int ra = li_row_of(li, a);
+    int rz = li_row_of(li, z);
+    int gone = rz - ra;
+
+    if (gone > 0) {
+        li_flush(li);
+        memmove(li->starts + ra + 1, li->starts + rz + 1, sizeof(int) * (size_t)(li->count - rz - 1));
+        li->count -= gone;
+    }
+    li_shift(li, ra + 1, -(z - a));
+}
 
 static void buf_init(Buffer *b) {
     b->cap = 1024;
@@ -40,8 +215,117 @@ static void buf_init(Buffer *b) {
     b->len = 0;
     b->cursor = 0;
     if (b->data) b->data[0] = '\0';
+    li_init(&b->lines);
+    b->undo = (UndoStack){0};
+    b->touchA = 0; b->touchZ = -1; b->touchTail = 0;
+    b->version = 0;
+}
+
+static void undo_step_free(UndoStep *st) {
+    free(st->bytes);
+    free(st->spans);
+    li_free(&st->lines);
+}
+
+static void undo_truncate(UndoStack *u, int keep) {
+    for (int i = keep; i < u->count; i++) undo_step_free(&u->steps[i]);
+    u->count = keep;
+    if (u->pos > keep) u->pos = keep;
+}
+
+static void undo_clear(UndoStack *u) { undo_truncate(u, 0); }
+static void undo_free(UndoStack *u) { undo_clear(u); free(u->steps); *u = (UndoStack){0}; }
+
+// Room for one more step on top of the stack, dropping the oldest when full.
+static UndoStep *undo_slot(UndoStack *u) {
+    if (u->count == UNDO_MAX_STEPS) {
+        undo_step_free(&u->steps[0]);
+        memmove(u->steps, u->steps + 1, sizeof(UndoStep) * (size_t)(u->count - 1));
+        u->count--;
+        if (u->pos > u->count) u->pos = u->count;
+    }
+    if (u->count == u->cap) {
+        int cap = u->cap ? u->cap * 2 : 64;
+        UndoStep *p = (UndoStep*)realloc(u->steps, sizeof(UndoStep) * (size_t)cap);
+        if (!p) return NULL;
+        u->steps = p;
+        u->cap = cap;
+    }
+    return &u->steps[u->count];
+}
+
+// Whether typing s may extend the typing step top, by the text alone: a
+// step holds about a word, so a line break, the first character after
+// spaces, or a pause since the last typing starts a new one.
+static bool undo_typing_continues(UndoStack *u, const UndoStep *top, const char *s, int n) {
+    double now = GetTime();
+    bool idle = now - u->typedAt > UNDO_TYPING_GAP;
+    u->typedAt = now;
+    if (idle || !top || top->kind != UNDO_TYPING || n == 0) return false;
+
+    // The step's newest character; a batch step's first span stands for all.
+    int end = top->spanCount ? top->spans[1] + top->spans[2] : top->removedLen + top->insertedLen;
+    int ins = top->spanCount ? top->spans[2] : top->insertedLen;
+    if (ins == 0) return false;
+    char last = top->bytes[end - 1];
+    if (last == '\n' || memchr(s, '\n', (size_t)n)) return false;
+    return !((last == ' ' || last == '\t') && s[0] != ' ' && s[0] != '\t');
+}
+
+static void undo_record(UndoStack *u, UndoKind kind, int at, const char *removed, int removedLen,
+                        const char *inserted, int insertedLen, int cursorBefore, int cursorAfter) {
+    undo_truncate(u, u->pos);
+
+    UndoStep *top = u->count ? &u->steps[u->count - 1] : NULL;
+    bool typing = kind == UNDO_TYPING && undo_typing_continues(u, top, inserted, insertedLen);
+    if (top && kind == top->kind && top->spanCount == 0 && cursorBefore == top->cursorAfter) {
+        if (typing && removedLen == 0 && at == top->at + top->insertedLen) {
+            char *p = (char*)realloc(top->bytes, (size_t)(top->removedLen + top->insertedLen + insertedLen));
+            if (p) {
+                memcpy(p + top->removedLen + top->insertedLen, inserted, (size_t)insertedLen);
+                top->bytes = p;
+                top->insertedLen += insertedLen;
+                top->cursorAfter = cursorAfter;
+                return;
+            }
+        }
+        // Deletes extend the step backwards (Backspace) or forwards (Delete).
+        bool before = at + removedLen == top->at, after = at == top->at;
+        if (kind == UNDO_DELETE && insertedLen == 0 && top->insertedLen == 0 && (before || after)) {
+            char *p = (char*)realloc(top->bytes, (size_t)(top->removedLen + removedLen));
+            if (p) {
+                if (before) {
+                    memmove(p + removedLen, p, (size_t)top->removedLen);
+                    memcpy(p, removed, (size_t)removedLen);
+                    top->at = at;
+                } else {
+                    memcpy(p + top->removedLen, removed, (size_t)removedLen);
+                }
+                top->bytes = p;
+                top->removedLen += removedLen;
+                top->cursorAfter = cursorAfter;
+                return;
+            }
+        }
+    }
+
+    UndoStep *slot = undo_slot(u);
+    if (!slot) return;
+    char *bytes = (char*)malloc((size_t)(removedLen + insertedLen) + 1);
+    if (!bytes) { undo_clear(u); return; }
+    if (removedLen) memcpy(bytes, removed, (size_t)removedLen);
+    if (insertedLen) memcpy(bytes + removedLen, inserted, (size_t)insertedLen);
+
+    *slot = (UndoStep){ kind, at, bytes, removedLen, insertedLen, cursorBefore, cursorAfter, {0}, NULL, 0 };
+    u->count++;
+    u->pos = u->count;
+}
+
+static void buf_free(Buffer *b) {
+    free(b->data); b->data = NULL; b->len = b->cap = b->cursor = 0;
+    li_free(&b->lines);
+    undo_free(&b->undo);
 }
-static void buf_free(Buffer *b) { free(b->data); b->data = NULL; b->len = b->cap = b->cursor = 0; }
 
 static void buf_ensure(Buffer *b, int needed) {
     if (needed <= b->cap) return;
@@ -53,69 +337,374 @@ static void buf_ensure(Buffer *b, int needed) {
     b->cap = newcap;
 }
 
-static void buf_insert_bytes(Buffer *b, const char *s, int n) {
-    if (n <= 0) return;
-    buf_ensure(b, b->len + n + 1);
-    if (!b->data) return;
+static void buf_touch(Buffer *b, int rowA, int rowZ, int tail) {
+    b->version++;
+    if (b->touchZ < 0) { b->touchA = rowA; b->touchZ = rowZ; b->touchTail = tail; return; }
+    b->touchA = mini(b->touchA, rowA);
+    b->touchZ = maxi(b->touchZ, rowZ);
+    b->touchTail = mini(b->touchTail, tail);
+}
+
+static bool buf_take_touched(Buffer *b, int *rowA, int *rowZ, int *tail) {
+    if (b->touchZ < 0) return false;
+    *rowA = b->touchA; *rowZ = b->touchZ; *tail = b->touchTail;
+    b->touchZ = -1;
+    return true;
+}
+
+// Replaces [a, z) with s in one move of the tail and keeps the line index in
+// step. Leaves the cursor after s. Does not record undo.
+static bool buf_splice(Buffer *b, int a, int z, const char *s, int n) {
+    int delta = n - (z - a);
+    if (delta > 0) {
+        buf_ensure(b, b->len + delta + 1);
+        if (!b->data || b->len + delta + 1 > b->cap) return false;
+    }
+
+    int row = li_row_of(&b->lines, a), rowsBefore = b->lines.count;
+    li_on_delete(&b->lines, a, z);
+    memmove(b->data + a + n, b->data + z, (size_t)(b->len - z));
+    if (n) memcpy(b->data + a, s, (size_t)n);
+    if (n) li_on_insert(&b->lines, a, s, n);
+    int endRow = li_row_of(&b->lines, a + n);
+    buf_touch(b, row, b->lines.count != rowsBefore ? INT_MAX : endRow + 1, b->lines.count - endRow - 1);
 
-    memmove(b->data + b->cursor + n, b->data + b->cursor, (size_t)(b->len - b->cursor));
-    memcpy(b->data + b->cursor, s, (size_t)n);
-    b->len += n;
-    b->cursor += n;
+    b->len += delta;
     b->data[b->len] = '\0';
+    b->cursor = a + n;
+    return true;
+}
+
+// One replacement in a batch: [a, z) becomes s[0..n).
+typedef struct { int a, z; const char *s; int n; } Splice;
+
+// Applies sorted, non-overlapping splices, offsets as before any of them, in
+// one pass: every byte after the first splice moves at most once, gaps that
+// shift left front to back and gaps that shift right back to front. Rows
+// between the first and last splice are rebuilt from the old starts and the
+// inserted text; rows after only shift. The inserted text must not point into
+// the buffer. Does not record undo.
+static bool buf_splice_many(Buffer *b, const Splice *sp, int count) {
+    if (count == 0) return true;
+    long delta = 0;
+    for (int i = 0; i < count; i++) delta += sp[i].n - (sp[i].z - sp[i].a);
+    if (b->len + delta > INT_MAX - 1) return false;
+    if (delta > 0) {
+        buf_ensure(b, b->len + (int)delta + 1);
+        if (!b->data || b->len + delta + 1 > b->cap) return false;
+    }
+
+    LineIndex *li = &b->lines;
+    int r0 = li_row_of(li, sp[0].a), rEnd = li_row_of(li, sp[count - 1].z);
+    int extra = 0;
+    for (int i = 0; i < count; i++)
+        for (const char *q = sp[i].s, *e = sp[i].s + sp[i].n; q && (q = (const char*)memchr(q, '\n', (size_t)(e - q))) != NULL; q++) extra++;
+    int *mid = (int*)malloc(sizeof(int) * (size_t)(rEnd - r0 + extra + 1));
+    if (!mid) return false;
+
+    // New starts for rows r0+1..rEnd: old ones outside removed ranges,
+    // shifted, plus one after each inserted newline.
+    int nMid = 0, r = r0 + 1, shift = 0;
+    for (int i = 0; i < count; i++) {
+        for (; r <= rEnd && li_start(li, r) - 1 < sp[i].a; r++) mid[nMid++] = li_start(li, r) + shift;
+        for (; r <= rEnd && li_start(li, r) - 1 < sp[i].z; r++) {}
+        int at = sp[i].a + shift;
+        for (int k = 0; k < sp[i].n; k++) if (sp[i].s[k] == '\n') mid[nMid++] = at + k + 1;
+        shift += sp[i].n - (sp[i].z - sp[i].a);
+    }
+    for (; r <= rEnd; r++) mid[nMid++] = li_start(li, r) + shift;
+
+    // Gap i is the text after splice i, up to the next one.
+    char *d = b->data;
+    shift = 0;
+    for (int i = 0; i < count; i++) {
+        shift += sp[i].n - (sp[i].z - sp[i].a);
+        int gz = i + 1 < count ? sp[i + 1].a : b->len;
+        if (shift < 0) memmove(d + sp[i].z + shift, d + sp[i].z, (size_t)(gz - sp[i].z));
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        shift -= sp[i].n - (sp[i].z - sp[i].a);
+        int after = shift + sp[i].n - (sp[i].z - sp[i].a);
+        int gz = i + 1 < count ? sp[i + 1].a : b->len;
+        if (after > 0) memmove(d + sp[i].z + after, d + sp[i].z, (size_t)(gz - sp[i].z));
+    }
+    for (int i = 0; i < count; i++) {
+        if (sp[i].n) memcpy(d + sp[i].a + shift, sp[i].s, (size_t)sp[i].n);
+        shift += sp[i].n - (sp[i].z - sp[i].a);
+    }
+    b->len += (int)delta;
+    d[b->len] = '\0';
+
+    int oldMid = rEnd - r0, grow = nMid - oldMid;
+    if (grow != 0) {
+        if (!li_reserve(li, li->count + grow)) { free(mid); li_rebuild(li, d, b->len); buf_touch(b, 0, INT_MAX, 0); return true; }
+        li_flush(li);
+        memmove(li->starts + rEnd + 1 + grow, li->starts + rEnd + 1, sizeof(int) * (size_t)(li->count - rEnd - 1));
+        li->count += grow;
+    } else {
+        li_settle(li, rEnd + 1);
+    }
+    memcpy(li->starts + r0 + 1, mid, sizeof(int) * (size_t)nMid);
+    li_shift(li, rEnd + 1 + grow, (int)delta);
+    free(mid);
+
+    buf_touch(b, r0, grow ? INT_MAX : rEnd + 1, li->count - (rEnd + grow) - 1);
+    return true;
+}
+
+// Every change to the text goes through here so it lands on the undo stack.
+static void buf_edit(Buffer *b, int a, int z, const char *s, int n, UndoKind kind) {
+    a = clampi(a, 0, b->len);
+    z = clampi(z, a, b->len);
+    if (n < 0) n = 0;
+    if (a == z && n == 0) { b->cursor = a; return; }
+
+    int delta = n - (z - a);
+    if (delta > 0) {
+        buf_ensure(b, b->len + delta + 1);
+        if (!b->data || b->len + delta + 1 > b->cap) return;
+    }
+    undo_record(&b->undo, kind, a, b->data + a, z - a, s, n, b->cursor, a + n);
+    buf_splice(b, a, z, s, n);
+}
+
+// Records a batch as one undo step. A typing batch that carries on from the
+// newest step at every span, with the same number of spans, extends it.
+static void undo_record_many(UndoStack *u, UndoKind kind, const char *data, const Splice *sp, int count,
+                             int cursorBefore, int cursorAfter) {
+    undo_truncate(u, u->pos);
+
+    UndoStep *top = u->count ? &u->steps[u->count - 1] : NULL;
+    bool typing = kind == UNDO_TYPING && undo_typing_continues(u, top, sp[0].s, sp[0].n);
+    bool merge = typing && top->spanCount == count && cursorBefore == top->cursorAfter;
+    for (int i = 0, shift = 0; merge && i < count; i++) {
+        const int *t = top->spans + 3 * i;
+        if (sp[i].z != sp[i].a || sp[i].a != t[0] + shift + t[2]) merge = false;
+        shift += t[2] - t[1];
+    }
+    long bytes = 0;
+    for (int i = 0; i < count; i++) {
+        bytes += (sp[i].z - sp[i].a) + sp[i].n;
+        if (merge) bytes += top->spans[3 * i + 1] + top->spans[3 * i + 2];
+    }
+    if (bytes > INT_MAX) { undo_clear(u); return; }
+
+    char *p = (char*)malloc((size_t)bytes + 1);
+    int *spans = (int*)malloc(sizeof(int) * 3 * (size_t)count);
+    if (!p || !spans) { free(p); free(spans); undo_clear(u); return; }
+
+    // Old bytes of a merged step keep their place; new typing goes after
+    // each span's inserted bytes.
+    char *w = p;
+    const char *old = merge ? top->bytes : NULL;
+    for (int i = 0; i < count; i++) {
+        int rem = sp[i].z - sp[i].a;
+        if (merge) {
+            const int *t = top->spans + 3 * i;
+            memcpy(w, old, (size_t)(t[1] + t[2]));
+            w += t[1] + t[2];
+            old += t[1] + t[2];
+            spans[3 * i] = t[0];
+            spans[3 * i + 1] = t[1];
+            spans[3 * i + 2] = t[2] + sp[i].n;
+        } else {
+            memcpy(w, data + sp[i].a, (size_t)rem);
+            w += rem;
+            spans[3 * i] = sp[i].a;
+            spans[3 * i + 1] = rem;
+            spans[3 * i + 2] = sp[i].n;
+        }
+        if (sp[i].n) memcpy(w, sp[i].s, (size_t)sp[i].n);
+        w += sp[i].n;
+    }
+
+    if (merge) {
+        free(top->bytes);
+        free(top->spans);
+        top->bytes = p;
+        top->spans = spans;
+        top->cursorAfter = cursorAfter;
+        return;
+    }
+    UndoStep *slot = undo_slot(u);
+    if (!slot) { free(p); free(spans); return; }
+    *slot = (UndoStep){ kind, sp[0].a, p, 0, 0, cursorBefore, cursorAfter, {0}, spans, count };
+    u->count++;
+    u->pos = u->count;
+}
+
+// Replays a batch step forwards (redo) or backwards (undo).
+static bool buf_splice_step(Buffer *b, const UndoStep *st, bool forward) {
+    Splice *sp = (Splice*)malloc(sizeof(Splice) * (size_t)st->spanCount);
+    if (!sp) return false;
+    const char *p = st->bytes;
+    int shift = 0;
+    for (int i = 0; i < st->spanCount; i++) {
+        int at = st->spans[3 * i], rem = st->spans[3 * i + 1], ins = st->spans[3 * i + 2];
+        sp[i] = forward ? (Splice){ at, at + rem, p + rem, ins } : (Splice){ at + shift, at + shift + ins, p, rem };
+        shift += ins - rem;
+        p += rem + ins;
+    }
+    bool ok = buf_splice_many(b, sp, st->spanCount);
+    free(sp);
+    return ok;
+}
+
+// The batch form of buf_edit: sp is sorted by offset, and a splice starting
+// inside the one before it is cut to start where that one ends. Afterwards
+// each sp[i] holds where its text now sits, [a, z) in the new offsets, and
+// the cursor is at the end of sp[primary].
+static void buf_edit_many(Buffer *b, Splice *sp, int count, UndoKind kind, int primary) {
+    Splice *run = (Splice*)malloc(sizeof(Splice) * (size_t)(count ? count : 1));
+    if (!run) return;
+    int n = 0, prevZ = 0, shift = 0, cursorAfter = b->cursor;
+    for (int i = 0; i < count; i++) {
+        sp[i].a = clampi(maxi(sp[i].a, prevZ), 0, b->len);
+        sp[i].z = clampi(sp[i].z, sp[i].a, b->len);
+        prevZ = sp[i].z;
+        if (sp[i].a != sp[i].z || sp[i].n > 0) run[n++] = sp[i];
+        if (i == primary) cursorAfter = sp[i].a + shift + sp[i].n;
+        shift += sp[i].n - (sp[i].z - sp[i].a);
+    }
+    bool ok = true;
+    if (n == 1) {
+        buf_edit(b, run[0].a, run[0].z, run[0].s, run[0].n, kind);
+    } else if (n > 1) {
+        undo_record_many(&b->undo, kind, b->data, run, n, b->cursor, cursorAfter);
+        ok = buf_splice_many(b, run, n);
+    }
+    free(run);
+    if (!ok) return;
+
+    shift = 0;
+    for (int i = 0; i < count; i++) {
+        int d = sp[i].n - (sp[i].z - sp[i].a);
+        sp[i].a += shift;
+        sp[i].z = sp[i].a + sp[i].n;
+        shift += d;
+    }
+    b->cursor = cursorAfter;
 }
-static void buf_insert_byte(Buffer *b, char c) { buf_insert_bytes(b, &c, 1); }
 
 static void buf_delete_range(Buffer *b, int a, int z) {
     a = clampi(a, 0, b->len);
     z = clampi(z, 0, b->len);
     if (z <= a) return;
 
-    memmove(b->data + a, b->data + z, (size_t)(b->len - z));
-    b->len -= (z - a);
-    b->data[b->len] = '\0';
+    int cursor = b->cursor;
+    buf_edit(b, a, z, NULL, 0, UNDO_EDIT);
+
+    if (cursor > z) b->cursor = cursor - (z - a);
+    else if (cursor > a) b->cursor = a;
+    else b->cursor = cursor;
+}
+
+static void buf_replace_range(Buffer *b, int a, int z, const char *s, int n) {
+    buf_edit(b, a, z, s, n, UNDO_EDIT);
+}
+
+// Lengths of the longest shared start and, in what is left, shared end of
+// two texts. Compared a page at a time while the pages match.
+static void text_common(const char *a, int an, const char *b, int bn, int *head, int *tail) {
+    int n = mini(an, bn), h = 0, t = 0;
+    while (h + 4096 <= n && memcmp(a + h, b + h, 4096) == 0) h += 4096;
+    while (h < n && a[h] == b[h]) h++;
+    int m = n - h;
+    while (t + 4096 <= m && memcmp(a + an - t - 4096, b + bn - t - 4096, 4096) == 0) t += 4096;
+    while (t < m && a[an - t - 1] == b[bn - t - 1]) t++;
+    *head = h;
+    *tail = t;
+}
+
+// Exchanges the buffer's text and line index with the ones an UNDO_SWAP step
+// holds. Nothing is copied; only the rows between the shared start and end
+// of the two texts count as touched.
+static void buf_swap_text(Buffer *b, UndoStep *st) {
+    char *data = b->data;
+    int len = b->len;
+    LineIndex lines = b->lines;
+    b->data = st->bytes;
+    b->len = st->removedLen;
+    b->cap = st->removedLen + 1;
+    b->lines = st->lines;
+    st->bytes = data;
+    st->removedLen = len;
+    st->lines = lines;
+
+    int head, tail;
+    text_common(data, len, b->data, b->len, &head, &tail);
+    int rowA = li_row_of(&b->lines, head), rowZ = li_row_of(&b->lines, b->len - tail);
+    buf_touch(b, rowA, b->lines.count != lines.count ? INT_MAX : rowZ + 1, b->lines.count - rowZ - 1);
+}
+
+// Installs data (with its line index, both now owned by the buffer) as the
+// whole text, keeping the old text as one undo step.
+static void buf_replace_text(Buffer *b, char *data, int len, LineIndex lines, int cursorAfter) {
+    UndoStack *u = &b->undo;
+    undo_truncate(u, u->pos);
+    UndoStep *slot = undo_slot(u);
+    if (!slot) { free(data); li_free(&lines); return; }
+    *slot = (UndoStep){ UNDO_SWAP, 0, data, len, 0, b->cursor, cursorAfter, lines, NULL, 0 };
+    u->count++;
+    u->pos = u->count;
+    buf_swap_text(b, slot);
+    b->cursor = clampi(cursorAfter, 0, b->len);
+}
+
+static bool buf_undo(Buffer *b) {
+    UndoStack *u = &b->undo;
+    if (u->pos == 0) return false;
+    UndoStep *st = &u->steps[u->pos - 1];
+    if (st->kind == UNDO_SWAP) buf_swap_text(b, st);
+    else if (st->spanCount) { if (!buf_splice_step(b, st, false)) return false; }
+    else if (!buf_splice(b, st->at, st->at + st->insertedLen, st->bytes, st->removedLen)) return false;
+    u->pos--;
+    b->cursor = clampi(st->cursorBefore, 0, b->len);
+    return true;
+}
 
-    if (b->cursor > z) b->cursor -= (z - a);
-    else if (b->cursor > a) b->cursor = a;
+static bool buf_redo(Buffer *b) {
+    UndoStack *u = &b->undo;
+    if (u->pos == u->count) return false;
+    UndoStep *st = &u->steps[u->pos];
+    if (st->kind == UNDO_SWAP) buf_swap_text(b, st);
+    else if (st->spanCount) { if (!buf_splice_step(b, st, true)) return false; }
+    else if (!buf_splice(b, st->at, st->at + st->removedLen, st->bytes + st->removedLen, st->insertedLen)) return false;
+    u->pos++;
+    b->cursor = clampi(st->cursorAfter, 0, b->len);
+    return true;
 }
 
-static void buf_backspace(Buffer *b) {
-    if (b->cursor <= 0) return;
-    buf_delete_range(b, b->cursor - 1, b->cursor);
+// Hands [a, z) to the clipboard straight out of the buffer by borrowing the
+// byte at z as the terminator, so large copies make no intermediate copy.
+static void buf_copy_to_clipboard(Buffer *b, int a, int z) {
+    a = clampi(a, 0, b->len);
+    z = clampi(z, a, b->len);
+    char saved = b->data[z];
+    b->data[z] = '\0';
+    SetClipboardText(b->data + a);
+    b->data[z] = saved;
 }
 
 static void cursor_row_col(const Buffer *b, int *outRow, int *outCol) {
-    int row = 0, col = 0;
-    for (int i = 0; i < b->cursor && i < b->len; i++) {
-        if (b->data[i] == '\n') { row++; col = 0; }
-        else { col++; }
-    }
+    int row = li_row_of(&b->lines, b->cursor);
     *outRow = row;
-    *outCol = col;
+    *outCol = b->cursor - li_start(&b->lines, row);
 }
 
 static int line_start_index(const Buffer *b, int targetRow) {
-    int row = 0;
     if (targetRow <= 0) return 0;
-    for (int i = 0; i < b->len; i++) {
-        if (b->data[i] == '\n') {
-            row++;
-            if (row == targetRow) return i + 1;
-        }
-    }
-    return b->len;
+    if (targetRow >= b->lines.count) return b->len;
+    return li_start(&b->lines, targetRow);
 }
 
 static int line_end_index(const Buffer *b, int start) {
-    for (int i = start; i < b->len; i++) if (b->data[i] == '\n') return i;
+    int row = li_row_of(&b->lines, start);
+    if (row + 1 < b->lines.count) return li_start(&b->lines, row + 1) - 1;
     return b->len;
 }
 
-static int total_rows(const Buffer *b) {
-    int rows = 1;
-    for (int i = 0; i < b->len; i++) if (b->data[i] == '\n') rows++;
-    return rows;
-}
+static int total_rows(const Buffer *b) { return b->lines.count; }
 
 static int line_length_at_row(const Buffer *b, int row) {
     int s = line_start_index(b, row);
@@ -142,230 +731,4272 @@ static void move_end(Buffer *b) {
     b->cursor = line_end_index(b, s);
 }
 
+// --- Word motion ---
+// Bytes fall into classes; a word boundary is where the class changes.
+// The class table makes each step of a scan a single lookup, and runs of one
+// class are skipped in tight loops.
+enum { CC_WORD, CC_SPACE, CC_PUNCT, CC_NEWLINE };
+
+static unsigned char charClass[256];
+
+static void char_class_init(void) {
+    for (int c = 0; c < 256; c++) {
+        if (c == '\n') charClass[c] = CC_NEWLINE;
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') charClass[c] = CC_SPACE;
+        else if (isalnum(c) || c == '_' || c >= 128) charClass[c] = CC_WORD;
+        else charClass[c] = CC_PUNCT;
+    }
+}
+
+// End of the next word after pos; a line break counts as its own stop.
+static int word_right(const Buffer *b, int pos) {
+    const unsigned char *d = (const unsigned char*)b->data;
+    int n = b->len;
+    if (pos >= n) return n;
+    if (charClass[d[pos]] == CC_NEWLINE) return pos + 1;
+    while (pos < n && charClass[d[pos]] == CC_SPACE) pos++;
+    if (pos >= n || charClass[d[pos]] == CC_NEWLINE) return pos;
+    unsigned char cls = charClass[d[pos]];
+    while (pos < n && charClass[d[pos]] == cls) pos++;
+    return pos;
+}
+
+// Start of the word before pos.
+static int word_left(const Buffer *b, int pos) {
+    const unsigned char *d = (const unsigned char*)b->data;
+    if (pos <= 0) return 0;
+    if (charClass[d[pos - 1]] == CC_NEWLINE) return pos - 1;
+    while (pos > 0 && charClass[d[pos - 1]] == CC_SPACE) pos--;
+    if (pos <= 0 || charClass[d[pos - 1]] == CC_NEWLINE) return pos;
+    unsigned char cls = charClass[d[pos - 1]];
+    while (pos > 0 && charClass[d[pos - 1]] == cls) pos--;
+    return pos;
+}
+
+// --- Regex ---
+// Patterns compile to a Thompson NFA that becomes a DFA lazily: a DFA state is
+// built the first time the scan reaches it, and each transition is filled in
+// the first time its byte is seen. Scanning is linear in the text, and the
+// state cache is flushed when it fills, so memory stays bounded.
+//
+// Matches are leftmost-first. The forward DFA finds where the match ends; a
+// DFA of the reversed pattern, run backwards from there, finds where it
+// starts. When every match must contain a literal, stretches of text with no
+// live match are skipped with memmem.
+//
+// Syntax: . [..] [^..] \d \w \s \D \W \S \t \n \r \<punct> ^ $ ( ) (?: )
+// | * + ? {m} {m,} {m,n}, with ? after a repeat for the lazy form. . and
+// negated classes do not match a line break.
+#define RE_MAX_STATES 2048
+#define RE_MAX_POOL   (1 << 20)
+#define RE_MAX_INST   20000
+#define RE_MAX_REPEAT 1000
+#define RE_MAX_LIT    64
+
+typedef struct { uint32_t bits[8]; } ReSet;
+
+static bool re_set_has(const ReSet *s, unsigned char c) { return (s->bits[c >> 5] >> (c & 31)) & 1u; }
+static void re_set_add(ReSet *s, unsigned char c) { s->bits[c >> 5] |= 1u << (c & 31); }
+
+typedef enum { RA_EMPTY, RA_SET, RA_CAT, RA_ALT, RA_REPEAT, RA_BOL, RA_EOL } ReAstKind;
+
 typedef struct {
-    bool active;
-    int anchor;
-    int caret;
-} Selection;
+    unsigned char kind;
+    bool lazy;
+    int a, b;
+    int set;
+    int min, max;           // max < 0: unbounded
+} ReAst;
 
-static bool sel_has(const Selection *s) { return s->active && s->anchor != s->caret; }
-static int  sel_a(const Selection *s) { return mini(s->anchor, s->caret); }
-static int  sel_z(const Selection *s) { return maxi(s->anchor, s->caret); }
-static void sel_set_single(Selection *s, int idx) { s->active = false; s->anchor = s->caret = idx; }
+typedef struct {
+    const char *p;
+    bool icase;
+    ReAst *nodes;
+    int nNodes, capNodes;
+    ReSet *sets;
+    int nSets, capSets;
+    const char *err;
+} ReParser;
+
+static int re_node(ReParser *P, ReAstKind kind, int a, int b) {
+    if (P->nNodes == P->capNodes) {
+        int cap = P->capNodes ? P->capNodes * 2 : 64;
+        ReAst *p = (ReAst*)realloc(P->nodes, sizeof(ReAst) * (size_t)cap);
+        if (!p) { P->err = "out of memory"; return -1; }
+        P->nodes = p;
+        P->capNodes = cap;
+    }
+    P->nodes[P->nNodes] = (ReAst){ .kind = (unsigned char)kind, .a = a, .b = b, .set = -1 };
+    return P->nNodes++;
+}
 
-static int index_from_mouse(const Buffer *b, Rectangle textArea, int scrollRow, float lineH, float charW, Vector2 mouse) {
-    int relRow = (int)((mouse.y - textArea.y) / lineH);
-    if (relRow < 0) relRow = 0;
+static int re_new_set(ReParser *P) {
+    if (P->nSets == P->capSets) {
+        int cap = P->capSets ? P->capSets * 2 : 32;
+        ReSet *p = (ReSet*)realloc(P->sets, sizeof(ReSet) * (size_t)cap);
+        if (!p) { P->err = "out of memory"; return -1; }
+        P->sets = p;
+        P->capSets = cap;
+    }
+    P->sets[P->nSets] = (ReSet){0};
+    return P->nSets++;
+}
 
-    int row = scrollRow + relRow;
-    int maxRow = total_rows(b) - 1;
-    row = clampi(row, 0, maxRow);
+static void re_set_fold_case(ReSet *s) {
+    for (int c = 'a'; c <= 'z'; c++) {
+        if (re_set_has(s, (unsigned char)c) || re_set_has(s, (unsigned char)(c - 32))) {
+            re_set_add(s, (unsigned char)c);
+            re_set_add(s, (unsigned char)(c - 32));
+        }
+    }
+}
 
-    float relX = mouse.x - textArea.x;
-    int col = (int)((relX + (charW * 0.5f)) / charW);
-    if (col < 0) col = 0;
+// \d \w \s and their negations; returns false for any other letter.
+static bool re_class_escape(ReSet *s, char e) {
+    ReSet t = {0};
+    switch (tolower((unsigned char)e)) {
+    case 'd': for (int c = '0'; c <= '9'; c++) re_set_add(&t, (unsigned char)c); break;
+    case 'w': for (int c = 0; c < 256; c++) if (isalnum(c) || c == '_') re_set_add(&t, (unsigned char)c); break;
+    case 's': for (const char *w = " \t\r\n\f\v"; *w; w++) re_set_add(&t, (unsigned char)*w); break;
+    default: return false;
+    }
+    if (isupper((unsigned char)e)) {
+        for (int i = 0; i < 8; i++) t.bits[i] = ~t.bits[i];
+        t.bits['\n' >> 5] &= ~(1u << ('\n' & 31));
+    }
+    for (int i = 0; i < 8; i++) s->bits[i] |= t.bits[i];
+    return true;
+}
 
-    return index_at_row_col(b, row, col);
+static int re_escape_char(char e) {
+    switch (e) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    case 'f': return '\f';
+    case 'v': return '\v';
+    default: return isalnum((unsigned char)e) ? -1 : (unsigned char)e;
+    }
 }
 
-static bool save_to_path(const char *path, const Buffer *buf) {
-    FILE *f = fopen(path, "wb");
-    if (!f) return false;
-    size_t wrote = fwrite(buf->data, 1, (size_t)buf->len, f);
-    fclose(f);
-    return wrote == (size_t)buf->len;
+static int re_set_node(ReParser *P, int set) {
+    if (set < 0) return -1;
+    if (P->icase) re_set_fold_case(&P->sets[set]);
+    int n = re_node(P, RA_SET, -1, -1);
+    if (n >= 0) P->nodes[n].set = set;
+    return n;
 }
 
-static bool load_from_path(const char *path, Buffer *buf, Selection *sel, int *scrollRow) {
-    FILE *f = fopen(path, "rb");
-    if (!f) return false;
+static int re_parse_class(ReParser *P) {
+    int set = re_new_set(P);
+    if (set < 0) return -1;
+    bool negate = false;
+    if (*P->p == '^') { negate = true; P->p++; }
+
+    bool first = true;
+    while (*P->p && (*P->p != ']' || first)) {
+        first = false;
+        int lo;
+        if (*P->p == '\\') {
+            char e = P->p[1];
+            if (!e) { P->err = "trailing backslash"; return -1; }
+            P->p += 2;
+            if (re_class_escape(&P->sets[set], e)) continue;
+            lo = re_escape_char(e);
+            if (lo < 0) { P->err = "unknown escape"; return -1; }
+        } else {
+            lo = (unsigned char)*P->p++;
+        }
 
-    if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return false; }
-    long size = ftell(f);
-    if (size < 0) { fclose(f); return false; }
-    if (fseek(f, 0, SEEK_SET) != 0) { fclose(f); return false; }
+        int hi = lo;
+        if (P->p[0] == '-' && P->p[1] && P->p[1] != ']') {
+            P->p++;
+            if (*P->p == '\\') {
+                hi = P->p[1] ? re_escape_char(P->p[1]) : -1;
+                if (hi < 0) { P->err = "bad range"; return -1; }
+                P->p += 2;
+            } else {
+                hi = (unsigned char)*P->p++;
+            }
+            if (hi < lo) { P->err = "bad range"; return -1; }
+        }
+        for (int c = lo; c <= hi; c++) re_set_add(&P->sets[set], (unsigned char)c);
+    }
+    if (*P->p != ']') { P->err = "missing ]"; return -1; }
+    P->p++;
 
-    buf_ensure(buf, (int)size + 1);
-    if (!buf->data) { fclose(f); return false; }
+    if (P->icase) re_set_fold_case(&P->sets[set]);
+    if (negate) {
+        for (int i = 0; i < 8; i++) P->sets[set].bits[i] = ~P->sets[set].bits[i];
+        P->sets[set].bits['\n' >> 5] &= ~(1u << ('\n' & 31));
+    }
+    int n = re_node(P, RA_SET, -1, -1);
+    if (n >= 0) P->nodes[n].set = set;
+    return n;
+}
 
-    size_t got = fread(buf->data, 1, (size_t)size, f);
-    fclose(f);
+static int re_parse_alt(ReParser *P);
+
+static int re_parse_atom(ReParser *P) {
+    char c = *P->p;
+    switch (c) {
+    case '(': {
+        P->p++;
+        if (P->p[0] == '?' && P->p[1] == ':') P->p += 2;
+        int inner = re_parse_alt(P);
+        if (inner < 0) return -1;
+        if (*P->p != ')') { P->err = "missing )"; return -1; }
+        P->p++;
+        return inner;
+    }
+    case '[':
+        P->p++;
+        return re_parse_class(P);
+    case '.': {
+        P->p++;
+        int set = re_new_set(P);
+        if (set < 0) return -1;
+        for (int i = 0; i < 8; i++) P->sets[set].bits[i] = ~0u;
+        P->sets[set].bits['\n' >> 5] &= ~(1u << ('\n' & 31));
+        return re_set_node(P, set);
+    }
+    case '^': P->p++; return re_node(P, RA_BOL, -1, -1);
+    case '$': P->p++; return re_node(P, RA_EOL, -1, -1);
+    case '*': case '+': case '?': case '{':
+        P->err = "nothing to repeat";
+        return -1;
+    case '\\': {
+        char e = P->p[1];
+        if (!e) { P->err = "trailing backslash"; return -1; }
+        P->p += 2;
+        int set = re_new_set(P);
+        if (set < 0) return -1;
+        if (!re_class_escape(&P->sets[set], e)) {
+            int lit = re_escape_char(e);
+            if (lit < 0) { P->err = "unknown escape"; return -1; }
+            re_set_add(&P->sets[set], (unsigned char)lit);
+        }
+        return re_set_node(P, set);
+    }
+    default: {
+        P->p++;
+        int set = re_new_set(P);
+        if (set < 0) return -1;
+        re_set_add(&P->sets[set], (unsigned char)c);
+        return re_set_node(P, set);
+    }
+    }
+}
 
-    buf->len = (int)got;
-    buf->data[buf->len] = '\0';
-    buf->cursor = buf->len;
-    sel_set_single(sel, buf->cursor);
-    if (scrollRow) *scrollRow = 0;
+static bool re_parse_count(ReParser *P, int *out) {
+    if (!isdigit((unsigned char)*P->p)) return false;
+    long v = 0;
+    while (isdigit((unsigned char)*P->p)) {
+        v = v * 10 + (*P->p++ - '0');
+        if (v > RE_MAX_REPEAT) { P->err = "repeat count too large"; return false; }
+    }
+    *out = (int)v;
     return true;
 }
 
-static int wrap_fit_count(Font font, float fontSize, float maxWidth, const char *s, int n) {
-    if (n <= 0) return 0;
-    int lastSpace = -1;
+static int re_parse_repeat(ReParser *P) {
+    int atom = re_parse_atom(P);
+    while (atom >= 0) {
+        int min, max;
+        char c = *P->p;
+        if (c == '*') { min = 0; max = -1; P->p++; }
+        else if (c == '+') { min = 1; max = -1; P->p++; }
+        else if (c == '?') { min = 0; max = 1; P->p++; }
+        else if (c == '{') {
+            P->p++;
+            if (!re_parse_count(P, &min)) { if (!P->err) P->err = "bad repeat"; return -1; }
+            max = min;
+            if (*P->p == ',') {
+                P->p++;
+                max = -1;
+                if (*P->p != '}' && (!re_parse_count(P, &max) || max < min)) { if (!P->err) P->err = "bad repeat"; return -1; }
+            }
+            if (*P->p != '}') { P->err = "bad repeat"; return -1; }
+            P->p++;
+        }
+        else break;
+
+        int r = re_node(P, RA_REPEAT, atom, -1);
+        if (r < 0) return -1;
+        P->nodes[r].min = min;
+        P->nodes[r].max = max;
+        if (*P->p == '?') { P->nodes[r].lazy = true; P->p++; }
+        atom = r;
+    }
+    return atom;
+}
 
-    char tmp[4096];
-    int limit = (int)sizeof(tmp) - 1;
-    int takeMax = (n < limit) ? n : limit;
+static int re_parse_cat(ReParser *P) {
+    int left = -1;
+    while (*P->p && *P->p != '|' && *P->p != ')') {
+        int r = re_parse_repeat(P);
+        if (r < 0) return -1;
+        left = left < 0 ? r : re_node(P, RA_CAT, left, r);
+        if (left < 0) return -1;
+    }
+    return left < 0 ? re_node(P, RA_EMPTY, -1, -1) : left;
+}
 
-    for (int i = 0; i < takeMax; i++) {
-        tmp[i] = s[i];
-        tmp[i+1] = '\0';
-        if (s[i] == ' ') lastSpace = i;
+static int re_parse_alt(ReParser *P) {
+    int left = re_parse_cat(P);
+    while (left >= 0 && *P->p == '|') {
+        P->p++;
+        int right = re_parse_cat(P);
+        if (right < 0) return -1;
+        left = re_node(P, RA_ALT, left, right);
+    }
+    return left;
+}
 
-        float w = MeasureTextEx(font, tmp, fontSize, 0).x;
-        if (w > maxWidth) {
-            if (lastSpace >= 0) return lastSpace + 1;
-            return (i > 0) ? i : 1;
+typedef enum { RE_SET, RE_SPLIT, RE_BOL, RE_EOL, RE_MATCH } ReOp;
+
+typedef struct {
+    unsigned char op;
+    int out, out1;
+    int set;
+} ReInst;
+
+typedef struct {
+    ReInst *inst;
+    int n, cap;
+    ReSet *sets;
+    int start;
+} ReProg;
+
+static int re_emit(ReProg *g, ReOp op, int out, int out1, int set) {
+    if (g->n == RE_MAX_INST) return -1;
+    if (g->n == g->cap) {
+        int cap = g->cap ? g->cap * 2 : 64;
+        ReInst *p = (ReInst*)realloc(g->inst, sizeof(ReInst) * (size_t)cap);
+        if (!p) return -1;
+        g->inst = p;
+        g->cap = cap;
+    }
+    g->inst[g->n] = (ReInst){ (unsigned char)op, out, out1, set };
+    return g->n++;
+}
+
+// Compiles node so that it continues into next; returns the entry point. A
+// reversed program matches the reversed language, with ^ and $ swapped.
+static int re_compile_node(ReProg *g, const ReAst *ast, int node, int next, bool reverse) {
+    const ReAst *n = &ast[node];
+    switch ((ReAstKind)n->kind) {
+    case RA_EMPTY: return next;
+    case RA_SET:   return re_emit(g, RE_SET, next, -1, n->set);
+    case RA_BOL:   return re_emit(g, reverse ? RE_EOL : RE_BOL, next, -1, -1);
+    case RA_EOL:   return re_emit(g, reverse ? RE_BOL : RE_EOL, next, -1, -1);
+    case RA_CAT: {
+        int second = re_compile_node(g, ast, reverse ? n->a : n->b, next, reverse);
+        if (second < 0) return -1;
+        return re_compile_node(g, ast, reverse ? n->b : n->a, second, reverse);
+    }
+    case RA_ALT: {
+        int x = re_compile_node(g, ast, n->a, next, reverse);
+        int y = x < 0 ? -1 : re_compile_node(g, ast, n->b, next, reverse);
+        return y < 0 ? -1 : re_emit(g, RE_SPLIT, x, y, -1);
+    }
+    case RA_REPEAT: {
+        int cur = next;
+        if (n->max < 0) {
+            int loop = re_emit(g, RE_SPLIT, -1, -1, -1);
+            int body = loop < 0 ? -1 : re_compile_node(g, ast, n->a, loop, reverse);
+            if (body < 0) return -1;
+            g->inst[loop].out = n->lazy ? next : body;
+            g->inst[loop].out1 = n->lazy ? body : next;
+            cur = loop;
+        } else {
+            for (int i = n->min; i < n->max; i++) {
+                int body = re_compile_node(g, ast, n->a, cur, reverse);
+                if (body < 0) return -1;
+                cur = n->lazy ? re_emit(g, RE_SPLIT, cur, body, -1) : re_emit(g, RE_SPLIT, body, cur, -1);
+                if (cur < 0) return -1;
+            }
         }
+        for (int i = 0; i < n->min; i++) {
+            cur = re_compile_node(g, ast, n->a, cur, reverse);
+            if (cur < 0) return -1;
+        }
+        return cur;
     }
-    return takeMax;
+    }
+    return -1;
 }
 
-static const char *base_name(const char *p) {
-    if (!p || !p[0]) return p;
-    const char *a = strrchr(p, '/');
-    const char *b = strrchr(p, '\\');
-    const char *m = a;
-    if (b && (!m || b > m)) m = b;
-    return m ? (m + 1) : p;
+// A DFA state is an ordered list of NFA positions (highest priority first)
+// plus whether new match attempts may still start, whether it sits at a line
+// start, and whether an attempt that started before this byte is still
+// alive. The last keeps a live attempt whose positions happen to equal a
+// fresh start from looking like the start state, which a scan takes to mean
+// nothing is in progress. $ positions stay in the list until the next byte
+// shows whether a line ends here.
+enum { RS_MATCH = 1, RS_MATCH_EOL = 2, RS_STARTS_DONE = 4, RS_BOL = 8, RS_LIVE = 16 };
+#define RS_KEY (RS_STARTS_DONE | RS_BOL | RS_LIVE)
+
+typedef struct {
+    int listOff, listLen;
+    unsigned char flags;
+    uint32_t hash;
+} ReState;
+
+typedef struct {
+    ReProg prog;
+    bool reverse;           // anchored and longest-match: used to find starts
+    ReState *states;
+    int nStates, capStates;
+    int *trans;             // nStates x 256, -1 until computed
+    int *pool;
+    int poolLen, poolCap;
+    int table[RE_MAX_STATES * 2];
+    int startState[2];      // by "at line start"
+    int flushes;
+    int *stack, *list, *list2;
+    unsigned *mark;
+    unsigned gen;
+} ReDfa;
+
+static void re_dfa_flush(ReDfa *d) {
+    d->nStates = 0;
+    d->poolLen = 0;
+    for (int i = 0; i < RE_MAX_STATES * 2; i++) d->table[i] = -1;
+    d->startState[0] = d->startState[1] = -1;
+    d->flushes++;
 }
 
-static void draw_text(Font f, const char *s, float x, float y, float size, Color c) {
-    DrawTextEx(f, s, (Vector2){x,y}, size, 0, c);
+static bool re_dfa_init(ReDfa *d, ReProg prog, bool reverse) {
+    *d = (ReDfa){ .prog = prog, .reverse = reverse };
+    size_t n = (size_t)prog.n;
+    d->stack = (int*)malloc(sizeof(int) * (2 * n + 2));
+    d->list = (int*)malloc(sizeof(int) * (n + 1));
+    d->list2 = (int*)malloc(sizeof(int) * (n + 1));
+    d->mark = (unsigned*)calloc(n + 1, sizeof(unsigned));
+    re_dfa_flush(d);
+    return d->stack && d->list && d->list2 && d->mark;
 }
 
-static bool ui_button(Rectangle r, const char *label, Font font, float fontSize,
-                      Color bg, Color hover, Color pressed, Color fg) {
-    Vector2 m = GetMousePosition();
-    bool hot = CheckCollisionPointRec(m, r);
-    bool down = hot && IsMouseButtonDown(MOUSE_LEFT_BUTTON);
+static void re_dfa_free(ReDfa *d) {
+    free(d->prog.inst);
+    free(d->states);
+    free(d->trans);
+    free(d->pool);
+    free(d->stack);
+    free(d->list);
+    free(d->list2);
+    free(d->mark);
+    *d = (ReDfa){0};
+}
 
-    Color c = bg;
-    if (hot) c = hover;
-    if (down) c = pressed;
+// Appends the positions reachable from pc without consuming a byte, in
+// priority order, skipping ones already in this list (same generation).
+// eol: the next byte is a line break or the end, so $ passes.
+static void re_closure(ReDfa *d, int pc, bool bol, bool eol, int *out, int *n) {
+    int sp = 0;
+    d->stack[sp++] = pc;
+    while (sp > 0) {
+        int s = d->stack[--sp];
+        if (s < 0 || d->mark[s] == d->gen) continue;
+        d->mark[s] = d->gen;
+        const ReInst *in = &d->prog.inst[s];
+        switch ((ReOp)in->op) {
+        case RE_SPLIT: d->stack[sp++] = in->out1; d->stack[sp++] = in->out; break;
+        case RE_BOL:   if (bol) d->stack[sp++] = in->out; break;
+        case RE_EOL:   if (eol) d->stack[sp++] = in->out; else out[(*n)++] = s; break;
+        default:       out[(*n)++] = s; break;
+        }
+    }
+}
 
-    DrawRectangleRounded(r, 0.25f, 10, c);
-    DrawRectangleRoundedLines(r, 0.25f, 10, (Color){35,42,54,255});
+// Leftmost-first: positions after a match have lower priority than it and
+// can never win, so the forward DFA drops them.
+static int re_cut(const ReDfa *d, const int *list, int n) {
+    if (d->reverse) return n;
+    for (int i = 0; i < n; i++)
+        if (d->prog.inst[list[i]].op == RE_MATCH) return i + 1;
+    return n;
+}
 
-    Vector2 t = MeasureTextEx(font, label, fontSize, 0);
-    DrawTextEx(font, label,
-               (Vector2){ r.x + (r.width - t.x)/2.0f, r.y + (r.height - t.y)/2.0f },
-               fontSize, 0, fg);
+// Expands the $ positions of list (the next byte ends the line) into list2.
+static int re_expand_eol(ReDfa *d, const int *list, int n, bool bol) {
+    int m = 0;
+    d->gen++;
+    for (int i = 0; i < n; i++) {
+        const ReInst *in = &d->prog.inst[list[i]];
+        if (in->op == RE_EOL) re_closure(d, in->out, bol, true, d->list2, &m);
+        else if (d->mark[list[i]] != d->gen) { d->mark[list[i]] = d->gen; d->list2[m++] = list[i]; }
+    }
+    return re_cut(d, d->list2, m);
+}
+
+static int re_intern(ReDfa *d, const int *list, int n, unsigned char key) {
+    uint32_t h = 2166136261u ^ key;
+    for (int i = 0; i < n; i++) h = (h ^ (uint32_t)list[i]) * 16777619u;
+
+    int mask = RE_MAX_STATES * 2 - 1;
+    for (int slot = (int)(h & (uint32_t)mask); d->table[slot] >= 0; slot = (slot + 1) & mask) {
+        const ReState *s = &d->states[d->table[slot]];
+        if (s->hash == h && s->listLen == n && (s->flags & RS_KEY) == key &&
+            memcmp(d->pool + s->listOff, list, sizeof(int) * (size_t)n) == 0)
+            return d->table[slot];
+    }
+
+    if (d->nStates == RE_MAX_STATES || d->poolLen + n > RE_MAX_POOL) re_dfa_flush(d);
+    if (d->nStates == d->capStates) {
+        int cap = d->capStates ? d->capStates * 2 : 64;
+        ReState *s = (ReState*)realloc(d->states, sizeof(ReState) * (size_t)cap);
+        if (s) d->states = s;
+        int *t = (int*)realloc(d->trans, sizeof(int) * 256 * (size_t)cap);
+        if (t) d->trans = t;
+        if (!s || !t) return -1;
+        d->capStates = cap;
+    }
+    if (d->poolLen + n > d->poolCap) {
+        int cap = d->poolCap ? d->poolCap : 1024;
+        while (cap < d->poolLen + n) cap *= 2;
+        int *p = (int*)realloc(d->pool, sizeof(int) * (size_t)cap);
+        if (!p) return -1;
+        d->pool = p;
+        d->poolCap = cap;
+    }
+
+    unsigned char flags = key;
+    for (int i = 0; i < n; i++) if (d->prog.inst[list[i]].op == RE_MATCH) flags |= RS_MATCH;
+    memcpy(d->pool + d->poolLen, list, sizeof(int) * (size_t)n);
+    int id = d->nStates++;
+    d->states[id] = (ReState){ d->poolLen, n, flags, h };
+    d->poolLen += n;
+    for (int c = 0; c < 256; c++) d->trans[id * 256 + c] = -1;
+
+    // The $ expansion is needed now only to know whether a match ends here.
+    int m = re_expand_eol(d, d->pool + d->states[id].listOff, n, (key & RS_BOL) != 0);
+    for (int i = 0; i < m; i++) if (d->prog.inst[d->list2[i]].op == RE_MATCH) d->states[id].flags |= RS_MATCH_EOL;
+
+    for (int slot = (int)(h & (uint32_t)mask); ; slot = (slot + 1) & mask)
+        if (d->table[slot] < 0) { d->table[slot] = id; break; }
+    return id;
+}
+
+static int re_start(ReDfa *d, bool bol) {
+    if (d->startState[bol] >= 0) return d->startState[bol];
+    int n = 0;
+    d->gen++;
+    re_closure(d, d->prog.start, bol, false, d->list, &n);
+    n = re_cut(d, d->list, n);
+    int id = re_intern(d, d->list, n, (unsigned char)((d->reverse ? RS_STARTS_DONE : 0) | (bol ? RS_BOL : 0)));
+    d->startState[bol] = id;
+    return id;
+}
+
+static int re_step(ReDfa *d, int st, unsigned char c) {
+    int t = d->trans[st * 256 + c];
+    if (t >= 0) return t;
+
+    const ReState *S = &d->states[st];
+    const int *src = d->pool + S->listOff;
+    int srcLen = S->listLen;
+    bool sawMatch = (S->flags & RS_MATCH) != 0;
+    if (c == '\n') {
+        srcLen = re_expand_eol(d, src, srcLen, (S->flags & RS_BOL) != 0);
+        src = d->list2;
+        sawMatch |= (S->flags & RS_MATCH_EOL) != 0;
+    }
+
+    int n = 0;
+    d->gen++;
+    for (int i = 0; i < srcLen; i++) {
+        const ReInst *in = &d->prog.inst[src[i]];
+        if (in->op == RE_MATCH && !d->reverse) break;
+        if (in->op == RE_SET && re_set_has(&d->prog.sets[in->set], c))
+            re_closure(d, in->out, c == '\n', false, d->list, &n);
+    }
+    unsigned char startsDone = (S->flags & RS_STARTS_DONE) || sawMatch ? RS_STARTS_DONE : 0;
+    unsigned char live = n > 0 ? RS_LIVE : 0;
+    if (!startsDone) re_closure(d, d->prog.start, c == '\n', false, d->list, &n);
+    n = re_cut(d, d->list, n);
+
+    int flushes = d->flushes;
+    t = re_intern(d, d->list, n, (unsigned char)(startsDone | live | (c == '\n' ? RS_BOL : 0)));
+    if (t >= 0 && flushes == d->flushes) d->trans[st * 256 + c] = t;
+    return t;
+}
+
+static bool re_dead(const ReDfa *d, int st) {
+    return d->states[st].listLen == 0 && (d->states[st].flags & RS_STARTS_DONE);
+}
+
+typedef struct {
+    ReDfa fwd, rev;
+    ReSet *sets;
+    char lit[RE_MAX_LIT];
+    int litLen;
+    bool litPrefix;
+    bool singleLine;
+} Regex;
+
+typedef struct { int a, z; } ReMatch;
+
+static void regex_free(Regex *re) {
+    re_dfa_free(&re->fwd);
+    re_dfa_free(&re->rev);
+    free(re->sets);
+    *re = (Regex){0};
+}
+
+static void re_flatten_cat(const ReAst *ast, int node, int *out, int *n, int cap) {
+    if (ast[node].kind == RA_CAT) {
+        re_flatten_cat(ast, ast[node].a, out, n, cap);
+        re_flatten_cat(ast, ast[node].b, out, n, cap);
+    } else if (*n < cap) {
+        out[(*n)++] = node;
+    }
+}
+
+static int re_single_byte(const ReSet *s) {
+    int found = -1;
+    for (int c = 0; c < 256; c++) {
+        if (!re_set_has(s, (unsigned char)c)) continue;
+        if (found >= 0) return -1;
+        found = c;
+    }
+    return found;
+}
+
+// Picks the longest run of single-byte atoms in the top-level sequence. It is
+// only useful as a skip target when it starts the pattern, or when matches
+// cannot span lines (then a hit rewinds to the start of its line).
+static void re_extract_literal(Regex *re, const ReAst *ast, int root, const ReSet *sets) {
+    int factors[512], nf = 0;
+    re_flatten_cat(ast, root, factors, &nf, 512);
+    if (nf == 512) return;
+
+    int first = 0;
+    while (first < nf && (ast[factors[first]].kind == RA_BOL || ast[factors[first]].kind == RA_EOL)) first++;
+
+    int bestAt = -1, bestLen = 0;
+    for (int i = first; i < nf; ) {
+        int len = 0;
+        while (i + len < nf && ast[factors[i + len]].kind == RA_SET && re_single_byte(&sets[ast[factors[i + len]].set]) >= 0) len++;
+        if (len > bestLen && (i == first || re->singleLine)) { bestAt = i; bestLen = len; }
+        i += len ? len : 1;
+    }
+    if (bestLen == 0) return;
+
+    re->litLen = mini(bestLen, RE_MAX_LIT);
+    re->litPrefix = bestAt == first;
+    for (int i = 0; i < re->litLen; i++) re->lit[i] = (char)re_single_byte(&sets[ast[factors[bestAt + i]].set]);
+}
+
+static bool regex_compile(Regex *re, const char *pattern, bool icase, const char **err) {
+    *re = (Regex){0};
+    ReParser P = { .p = pattern, .icase = icase };
+    int root = re_parse_alt(&P);
+    if (root >= 0 && *P.p) { P.err = "unmatched )"; root = -1; }
+    if (root < 0) {
+        *err = P.err ? P.err : "invalid pattern";
+        free(P.nodes); free(P.sets);
+        return false;
+    }
+
+    ReProg fwd = { .sets = P.sets }, rev = { .sets = P.sets };
+    int fm = re_emit(&fwd, RE_MATCH, -1, -1, -1);
+    fwd.start = fm < 0 ? -1 : re_compile_node(&fwd, P.nodes, root, fm, false);
+    int rm = re_emit(&rev, RE_MATCH, -1, -1, -1);
+    rev.start = rm < 0 ? -1 : re_compile_node(&rev, P.nodes, root, rm, true);
+    if (fwd.start < 0 || rev.start < 0) {
+        *err = "pattern too large";
+        free(fwd.inst); free(rev.inst); free(P.nodes); free(P.sets);
+        return false;
+    }
+
+    re->sets = P.sets;
+    re->singleLine = true;
+    for (int i = 0; i < P.nSets; i++) if (re_set_has(&P.sets[i], '\n')) re->singleLine = false;
+    re_extract_literal(re, P.nodes, root, P.sets);
+    free(P.nodes);
+
+    bool ok = re_dfa_init(&re->fwd, fwd, false);
+    ok = re_dfa_init(&re->rev, rev, true) && ok;
+    if (!ok) { regex_free(re); *err = "out of memory"; return false; }
+    return true;
+}
+
+// Finds the first match starting at or after from. The scan gives up at the
+// first point at or after stop where no match attempt is alive; *resume is
+// where a later call should continue. Pass stop = len to search to the end.
+static bool regex_search(Regex *re, const char *text, int len, int from, int stop, ReMatch *m, int *resume) {
+    const unsigned char *s = (const unsigned char*)text;
+    ReDfa *d = &re->fwd;
+    int pos = from, end = -1, hit = -1, jump = -1;
+    int st = re_start(d, pos == 0 || s[pos - 1] == '\n');
+
+    while (st >= 0) {
+        if (end < 0 && (st == d->startState[0] || st == d->startState[1])) {
+            if (pos >= stop && pos < len) break;
+            if (re->litLen > 0) {
+                if (hit < pos) {
+                    const char *h = (const char*)memmem(text + pos, (size_t)(len - pos), re->lit, (size_t)re->litLen);
+                    if (!h) { pos = len; break; }
+                    hit = (int)(h - text);
+                    jump = hit;
+                    if (!re->litPrefix) {
+                        const char *nl = (const char*)memrchr(text + pos, '\n', (size_t)(hit - pos));
+                        jump = nl ? (int)(nl - text) + 1 : pos;
+                    }
+                }
+                if (jump > pos) {
+                    if (jump > stop) { pos = jump; break; }
+                    pos = jump;
+                    st = re_start(d, s[pos - 1] == '\n');
+                    if (st < 0) break;
+                }
+            }
+        }
+
+        unsigned char f = d->states[st].flags;
+        if (pos == len) {
+            if (f & (RS_MATCH | RS_MATCH_EOL)) end = pos;
+            break;
+        }
+        if ((f & RS_MATCH) || ((f & RS_MATCH_EOL) && s[pos] == '\n')) end = pos;
+        int t = d->trans[st * 256 + s[pos]];
+        st = t >= 0 ? t : re_step(d, st, s[pos]);
+        pos++;
+        if (st >= 0 && re_dead(d, st)) break;
+    }
+    if (resume) *resume = pos;
+    if (end < 0) return false;
+
+    // Walk back from the end with the reversed pattern; the furthest point
+    // where it matches is where the leftmost match starts.
+    ReDfa *r = &re->rev;
+    int p = end, start = end;
+    st = re_start(r, p == len || s[p] == '\n');
+    while (st >= 0) {
+        unsigned char f = r->states[st].flags;
+        bool lineStart = p == 0 || s[p - 1] == '\n';
+        if ((f & RS_MATCH) || ((f & RS_MATCH_EOL) && lineStart)) start = p;
+        if (p == from) break;
+        st = re_step(r, st, s[p - 1]);
+        p--;
+        if (st >= 0 && re_dead(r, st)) break;
+    }
+    m->a = start;
+    m->z = end;
+    return true;
+}
+
+typedef struct {
+    bool active;
+    int anchor;
+    int caret;
+} Selection;
+
+static bool sel_has(const Selection *s) { return s->active && s->anchor != s->caret; }
+static int  sel_a(const Selection *s) { return mini(s->anchor, s->caret); }
+static int  sel_z(const Selection *s) { return maxi(s->anchor, s->caret); }
+static void sel_set_single(Selection *s, int idx) { s->active = false; s->anchor = s->caret = idx; }
+
+// Row and column under the mouse; the column may lie past the end of the line.
+static void row_col_from_mouse(const Buffer *b, Rectangle textArea, float scrollY, float scrollX, float lineH, float charW,
+                               Vector2 mouse, int *outRow, int *outCol) {
+    float relRow = (mouse.y - textArea.y) / lineH;
+    if (relRow < 0.0f) relRow = 0.0f;
+
+    int row = (int)(scrollY + relRow);
+    int maxRow = total_rows(b) - 1;
+    *outRow = clampi(row, 0, maxRow);
+
+    float relX = mouse.x - textArea.x + scrollX;
+    int col = (int)((relX + (charW * 0.5f)) / charW);
+    *outCol = col < 0 ? 0 : col;
+}
+
+static int index_from_mouse(const Buffer *b, Rectangle textArea, float scrollY, float scrollX, float lineH, float charW, Vector2 mouse) {
+    int row, col;
+    row_col_from_mouse(b, textArea, scrollY, scrollX, lineH, charW, mouse, &row, &col);
+    return index_at_row_col(b, row, col);
+}
+
+// --- Multiple cursors ---
+// Ctrl+click adds a cursor and Ctrl+D selects the next occurrence of the
+// selection. While there is more than one, every cursor lives here sorted by
+// position, the primary one mirrored into the editor's Selection and
+// buf.cursor. An edit at all of them is one batch over the text
+// (buf_edit_many), and their new offsets come straight out of it.
+typedef struct {
+    Selection *sels;
+    int count, cap;
+    int primary;
+    unsigned version;   // the buffer version the offsets belong to
+} Carets;
+
+static void carets_clear(Carets *c) { c->count = 0; c->primary = 0; }
+static void carets_free(Carets *c) { free(c->sels); *c = (Carets){0}; }
+
+static bool carets_push(Carets *c, Selection s) {
+    if (c->count == c->cap) {
+        int cap = c->cap ? c->cap * 2 : 16;
+        Selection *p = (Selection*)realloc(c->sels, sizeof(Selection) * (size_t)cap);
+        if (!p) return false;
+        c->sels = p;
+        c->cap = cap;
+    }
+    s.active = s.anchor != s.caret;
+    c->sels[c->count++] = s;
+    return true;
+}
+
+static int carets_cmp(const void *x, const void *y) {
+    const Selection *p = (const Selection*)x, *q = (const Selection*)y;
+    int d = sel_a(p) - sel_a(q);
+    return d ? d : sel_z(p) - sel_z(q);
+}
+
+// Sorts and merges cursors that overlap or sit at the same place, keeping
+// track of the primary one.
+static void carets_normalize(Carets *c) {
+    if (c->count == 0) return;
+    Selection prim = c->sels[c->primary];
+    qsort(c->sels, (size_t)c->count, sizeof(Selection), carets_cmp);
+    int n = 0;
+    c->primary = 0;
+    for (int i = 0; i < c->count; i++) {
+        Selection s = c->sels[i];
+        bool isPrim = s.anchor == prim.anchor && s.caret == prim.caret;
+        Selection *last = n ? &c->sels[n - 1] : NULL;
+        if (last && (sel_a(&s) < sel_z(last) || (sel_a(&s) == sel_z(last) && (!sel_has(&s) || !sel_has(last))))) {
+            // Keep the merged range pointing the way the later one did.
+            int a = sel_a(last), z = maxi(sel_z(last), sel_z(&s));
+            bool back = s.caret < s.anchor;
+            last->anchor = back ? z : a;
+            last->caret = back ? a : z;
+            last->active = a != z;
+            if (isPrim) c->primary = n - 1;
+            continue;
+        }
+        if (isPrim) c->primary = n;
+        c->sels[n++] = s;
+    }
+    c->count = n;
+}
+
+// Starts multi-cursor mode from the editor's single cursor.
+static void carets_seed(Carets *c, const Selection *sel, int cursor, const Buffer *b) {
+    if (c->count > 0) return;
+    Selection s = sel_has(sel) ? *sel : (Selection){ false, cursor, cursor };
+    carets_push(c, s);
+    c->primary = 0;
+    c->version = b->version;
+}
+
+// Adds s and makes it the primary cursor.
+static void carets_add(Carets *c, Selection s) {
+    if (!carets_push(c, s)) return;
+    c->primary = c->count - 1;
+    carets_normalize(c);
+}
+
+static void carets_sync(const Carets *c, Selection *sel, Buffer *b) {
+    if (c->count == 0) return;
+    *sel = c->sels[c->primary];
+    b->cursor = sel->caret;
+}
+
+// Drops the extra cursors once something other than them moved the primary
+// cursor or changed the text.
+static void carets_check(Carets *c, const Selection *sel, const Buffer *b) {
+    if (c->count <= 1) { carets_clear(c); return; }
+    const Selection *p = &c->sels[c->primary];
+    bool same = b->cursor == p->caret && (sel_has(sel) ? sel->anchor == p->anchor && sel->caret == p->caret : !sel_has(p));
+    if (!same || b->version != c->version) carets_clear(c);
+}
+
+// Replaces each cursor's selection, or inserts at each cursor, with its own
+// text from sp (filled in by the caller, one per cursor in order), as one
+// edit; every cursor ends up after its text.
+static void carets_apply(Carets *c, Buffer *b, Splice *sp, UndoKind kind) {
+    buf_edit_many(b, sp, c->count, kind, c->primary);
+    for (int i = 0; i < c->count; i++) c->sels[i] = (Selection){ false, sp[i].z, sp[i].z };
+    carets_normalize(c);
+    c->version = b->version;
+}
+
+static Splice *carets_splices(const Carets *c) {
+    return (Splice*)malloc(sizeof(Splice) * (size_t)c->count);
+}
+
+static void carets_type(Carets *c, Buffer *b, const char *s, int n, UndoKind kind) {
+    Splice *sp = carets_splices(c);
+    if (!sp) return;
+    for (int i = 0; i < c->count; i++) sp[i] = (Splice){ sel_a(&c->sels[i]), sel_z(&c->sels[i]), s, n };
+    carets_apply(c, b, sp, kind);
+    free(sp);
+}
+
+// Backspace and Delete at every cursor. A selection absorbs the first press,
+// as with one cursor.
+static void carets_delete(Carets *c, Buffer *b, int backs, int dels, bool words) {
+    Splice *sp = carets_splices(c);
+    if (!sp) return;
+    for (int i = 0; i < c->count; i++) {
+        Selection *s = &c->sels[i];
+        int a = sel_a(s), z = sel_z(s), nb = backs, nd = dels;
+        if (sel_has(s)) { if (nb > 0) nb--; else nd--; }
+        for (int k = 0; k < nb; k++) a = words ? word_left(b, a) : maxi(a - 1, 0);
+        for (int k = 0; k < nd; k++) z = words ? word_right(b, z) : mini(z + 1, b->len);
+        sp[i] = (Splice){ a, z, NULL, 0 };
+    }
+    carets_apply(c, b, sp, words ? UNDO_DELETE : UNDO_EDIT);
+    free(sp);
+}
+
+// Moves every cursor by dx characters (or words); without extend, a
+// selection first collapses to the side it is moving towards.
+static void carets_move(Carets *c, const Buffer *b, int rights, int lefts, bool words, bool extend) {
+    for (int i = 0; i < c->count; i++) {
+        Selection *s = &c->sels[i];
+        int pos = s->caret;
+        if (!extend && sel_has(s) && !words) pos = rights > lefts ? sel_z(s) : sel_a(s);
+        else if (words) {
+            for (int k = 0; k < rights; k++) pos = word_right(b, pos);
+            for (int k = 0; k < lefts; k++) pos = word_left(b, pos);
+        } else pos = clampi(pos + rights - lefts, 0, b->len);
+        s->caret = pos;
+        if (!extend) s->anchor = pos;
+        s->active = s->anchor != s->caret;
+    }
+    carets_normalize(c);
+}
+
+static void carets_move_rows(Carets *c, const Buffer *b, int dy, bool extend) {
+    for (int i = 0; i < c->count; i++) {
+        Selection *s = &c->sels[i];
+        int row = li_row_of(&b->lines, s->caret);
+        int col = s->caret - li_start(&b->lines, row);
+        s->caret = index_at_row_col(b, clampi(row + dy, 0, total_rows(b) - 1), col);
+        if (!extend) s->anchor = s->caret;
+        s->active = s->anchor != s->caret;
+    }
+    carets_normalize(c);
+}
+
+static void carets_home_end(Carets *c, const Buffer *b, bool end, bool extend) {
+    for (int i = 0; i < c->count; i++) {
+        Selection *s = &c->sels[i];
+        int start = line_start_index(b, li_row_of(&b->lines, s->caret));
+        s->caret = end ? line_end_index(b, start) : start;
+        if (!extend) s->anchor = s->caret;
+        s->active = s->anchor != s->caret;
+    }
+    carets_normalize(c);
+}
+
+// Index of the first cursor whose range ends at or after pos.
+static int carets_find(const Carets *c, int pos) {
+    int lo = 0, hi = c->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (sel_z(&c->sels[mid]) < pos) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// Ctrl+D: selects the word at an empty primary cursor, or adds the next
+// occurrence of the primary selection (wrapping) that is not selected yet.
+static bool carets_add_next(Carets *c, Selection *sel, Buffer *b) {
+    if (!sel_has(sel)) {
+        int a = b->cursor, z = b->cursor;
+        while (a > 0 && charClass[(unsigned char)b->data[a - 1]] == CC_WORD) a--;
+        while (z < b->len && charClass[(unsigned char)b->data[z]] == CC_WORD) z++;
+        if (a == z) return false;
+        sel->active = true; sel->anchor = a; sel->caret = z; b->cursor = z;
+        if (c->count > 0) { c->sels[c->primary] = *sel; carets_normalize(c); }
+        return true;
+    }
+    carets_seed(c, sel, b->cursor, b);
+    int a = sel_a(sel), n = sel_z(sel) - a;
+    int from = sel_z(sel);
+    for (int tries = 0; tries <= c->count; tries++) {
+        const char *hit = (const char*)memmem(b->data + from, (size_t)(b->len - from), b->data + a, (size_t)n);
+        if (!hit) hit = (const char*)memmem(b->data, (size_t)b->len, b->data + a, (size_t)n);
+        if (!hit) return false;
+        int p = (int)(hit - b->data);
+        int i = carets_find(c, p + 1);
+        if (i < c->count && sel_a(&c->sels[i]) <= p) { from = p + 1 <= b->len ? p + 1 : 0; continue; }
+        carets_add(c, (Selection){ true, p, p + n });
+        return true;
+    }
+    return false;
+}
+
+// The cursors' selections joined by newlines, for the clipboard.
+static char *carets_copy(const Carets *c, const Buffer *b) {
+    long n = 0;
+    for (int i = 0; i < c->count; i++) n += sel_z(&c->sels[i]) - sel_a(&c->sels[i]) + 1;
+    char *out = (char*)malloc((size_t)n + 1);
+    if (!out) return NULL;
+    char *w = out;
+    for (int i = 0; i < c->count; i++) {
+        int a = sel_a(&c->sels[i]), z = sel_z(&c->sels[i]);
+        memcpy(w, b->data + a, (size_t)(z - a));
+        w += z - a;
+        if (i + 1 < c->count) *w++ = '\n';
+    }
+    *w = '\0';
+    return out;
+}
+
+// Pastes one line of the clipboard at each cursor when the line count
+// matches the cursor count, and the whole of it at each one otherwise.
+static void carets_paste(Carets *c, Buffer *b, const char *clip) {
+    int len = (int)strlen(clip), lines = 1;
+    for (const char *q = clip; (q = strchr(q, '\n')) != NULL; q++) lines++;
+    if (len > 0 && clip[len - 1] == '\n') lines--;
+    Splice *sp = carets_splices(c);
+    if (!sp) return;
+    const char *q = clip;
+    for (int i = 0; i < c->count; i++) {
+        sp[i] = (Splice){ sel_a(&c->sels[i]), sel_z(&c->sels[i]), clip, len };
+        if (lines == c->count) {
+            const char *nl = strchr(q, '\n');
+            int n = nl ? (int)(nl - q) : (int)strlen(q);
+            sp[i].s = q;
+            sp[i].n = n;
+            q += n + (nl ? 1 : 0);
+        }
+    }
+    carets_apply(c, b, sp, UNDO_EDIT);
+    free(sp);
+}
+
+// Selections and carets of every cursor but the primary one (the editor
+// draws that) on one drawn stretch [segA, segZ) starting at x0. A caret at
+// segZ is drawn only when segZ ends the line.
+static void carets_draw(const Carets *c, int segA, int segZ, int lineEnd, float x0, float clipL, float clipR,
+                        float y, float fontSize, float charW, Color selBg, Color caret, bool caretOn) {
+    for (int i = carets_find(c, segA); i < c->count && sel_a(&c->sels[i]) <= segZ; i++) {
+        if (i == c->primary) continue;
+        const Selection *s = &c->sels[i];
+        if (sel_has(s)) {
+            float x1 = x0 + (maxi(sel_a(s), segA) - segA) * charW;
+            float x2 = x0 + (mini(sel_z(s), segZ) - segA) * charW;
+            if (x1 < clipL) x1 = clipL;
+            if (x2 > clipR) x2 = clipR;
+            if (x2 > x1) DrawRectangle((int)x1, (int)(y + 3), (int)(x2 - x1), (int)(fontSize + 6), selBg);
+        }
+        bool here = s->caret >= segA && (s->caret < segZ || (s->caret == segZ && segZ == lineEnd));
+        if (caretOn && here) {
+            float cx = x0 + (s->caret - segA) * charW;
+            if (cx >= clipL - 1 && cx <= clipR) DrawRectangle((int)cx, (int)(y + 4), 2, (int)(fontSize + 4), caret);
+        }
+    }
+}
+
+// --- Block selection ---
+// Alt+drag (or Alt+Shift+arrows) selects a rectangle of rows and columns.
+// Corners are kept as row/column pairs, so the block may reach past the end
+// of short rows. Only rows on screen are ever looked at to draw it; copy and
+// edits resolve every row's byte range from the line index in one pass and
+// apply as one batch (buf_edit_many). Typing into a block pads rows that are
+// too short with spaces, like every column-editing editor.
+typedef struct {
+    bool active;
+    int anchorRow, anchorCol;
+    int caretRow, caretCol;
+    unsigned version;   // the buffer version the block was last placed in
+} Block;
+
+static void block_bounds(const Block *k, const Buffer *b, int *r0, int *r1, int *c0, int *c1) {
+    int last = total_rows(b) - 1;
+    *r0 = clampi(mini(k->anchorRow, k->caretRow), 0, last);
+    *r1 = clampi(maxi(k->anchorRow, k->caretRow), 0, last);
+    *c0 = mini(k->anchorCol, k->caretCol);
+    *c1 = maxi(k->anchorCol, k->caretCol);
+}
+
+// Where the block's caret sits in the text (clamped to its row).
+static int block_cursor(const Block *k, const Buffer *b) {
+    return index_at_row_col(b, clampi(k->caretRow, 0, total_rows(b) - 1), k->caretCol);
+}
+
+// Byte ranges of the block on every row, [start + c0, start + c1) clipped to
+// the row. Row starts come from the line index, one lookup per row.
+static Splice *block_splices(const Block *k, const Buffer *b, int *count) {
+    int r0, r1, c0, c1;
+    block_bounds(k, b, &r0, &r1, &c0, &c1);
+    Splice *sp = (Splice*)malloc(sizeof(Splice) * (size_t)(r1 - r0 + 1));
+    if (!sp) return NULL;
+    for (int r = r0; r <= r1; r++) {
+        int ls = li_start(&b->lines, r);
+        int le = r + 1 < b->lines.count ? li_start(&b->lines, r + 1) - 1 : b->len;
+        sp[r - r0] = (Splice){ ls + mini(c0, le - ls), ls + mini(c1, le - ls), NULL, 0 };
+    }
+    *count = r1 - r0 + 1;
+    return sp;
+}
+
+// The block's rows joined by newlines, for the clipboard.
+static char *block_copy(const Block *k, const Buffer *b) {
+    int n;
+    Splice *sp = block_splices(k, b, &n);
+    if (!sp) return NULL;
+    long total = 0;
+    for (int i = 0; i < n; i++) total += sp[i].z - sp[i].a + 1;
+    char *out = (char*)malloc((size_t)total + 1);
+    if (out) {
+        char *w = out;
+        for (int i = 0; i < n; i++) {
+            memcpy(w, b->data + sp[i].a, (size_t)(sp[i].z - sp[i].a));
+            w += sp[i].z - sp[i].a;
+            if (i + 1 < n) *w++ = '\n';
+        }
+        *w = '\0';
+    }
+    free(sp);
+    return out;
+}
+
+// Replaces the block on every row with text: the same s on each row, or with
+// perRow set, the rows of s one per block row (missing ones empty). Rows that
+// end left of the block are padded with spaces first. The block collapses to
+// a column right after the text of the first row.
+static void block_fill(Block *k, Buffer *b, const char *s, int n, bool perRow, UndoKind kind) {
+    int count, r0, r1, c0, c1;
+    block_bounds(k, b, &r0, &r1, &c0, &c1);
+    Splice *sp = block_splices(k, b, &count);
+    if (!sp) return;
+
+    // Each row's text is one slice of scratch with its padding in front. The
+    // same text on every row is stored once after c0 spaces; rows of a
+    // multi-line paste are laid out one after another with their own.
+    long size = perRow ? (long)count * c0 + n : (long)c0 + n;
+    char *scratch = (char*)malloc((size_t)size + 1);
+    if (!scratch || size > INT_MAX) { free(scratch); free(sp); return; }
+    const char *q = s, *end = s + n;
+    char *w = scratch;
+    if (!perRow) { memset(scratch, ' ', (size_t)c0); memcpy(scratch + c0, s, (size_t)n); }
+    int firstLen = n;
+
+    for (int i = 0; i < count; i++) {
+        int pad = c0 - (sp[i].a - li_start(&b->lines, r0 + i));
+        if (!perRow) {
+            sp[i].s = scratch + c0 - pad;
+            sp[i].n = pad + n;
+            continue;
+        }
+        const char *nl = (const char*)memchr(q, '\n', (size_t)(end - q));
+        int tn = nl ? (int)(nl - q) : (int)(end - q);
+        memset(w, ' ', (size_t)pad);
+        memcpy(w + pad, q, (size_t)tn);
+        sp[i].s = w;
+        sp[i].n = pad + tn;
+        w += pad + tn;
+        q = nl ? nl + 1 : end;
+        if (i == 0) firstLen = tn;
+    }
+    buf_edit_many(b, sp, count, kind, clampi(k->caretRow, r0, r1) - r0);
+    free(scratch);
+    free(sp);
+
+    k->anchorRow = r0;
+    k->caretRow = r1;
+    k->anchorCol = k->caretCol = c0 + firstLen;
+    k->version = b->version;
+    b->cursor = block_cursor(k, b);
+}
+
+// Deletes the block's contents, each row's range as clipped to the row, so
+// short rows are left alone rather than padded. The block collapses to its
+// left column.
+static void block_clear(Block *k, Buffer *b) {
+    int count, r0, r1, c0, c1;
+    block_bounds(k, b, &r0, &r1, &c0, &c1);
+    Splice *sp = block_splices(k, b, &count);
+    if (!sp) return;
+    buf_edit_many(b, sp, count, UNDO_EDIT, clampi(k->caretRow, r0, r1) - r0);
+    free(sp);
+
+    k->anchorRow = r0;
+    k->caretRow = r1;
+    k->anchorCol = k->caretCol = c0;
+    k->version = b->version;
+    b->cursor = block_cursor(k, b);
+}
+
+// Backspace and Delete on a block: a block with width deletes its contents
+// on the first press, a bare column deletes the characters beside it.
+static void block_delete(Block *k, Buffer *b, int backs, int dels) {
+    int r0, r1, c0, c1;
+    block_bounds(k, b, &r0, &r1, &c0, &c1);
+    if (c1 > c0) {
+        block_clear(k, b);
+        if (backs > 0) backs--; else dels--;
+        if (backs + dels == 0) return;
+    }
+    int count;
+    Splice *sp = block_splices(k, b, &count);
+    if (!sp) return;
+    for (int i = 0; i < count; i++) {
+        int ls = li_start(&b->lines, r0 + i);
+        int le = r0 + i + 1 < b->lines.count ? li_start(&b->lines, r0 + i + 1) - 1 : b->len;
+        if (sp[i].a - ls == c0) {
+            sp[i].a = maxi(sp[i].a - backs, ls);
+            sp[i].z = mini(sp[i].z + dels, le);
+        }
+    }
+    buf_edit_many(b, sp, count, UNDO_DELETE, clampi(k->caretRow, r0, r1) - r0);
+    free(sp);
+    k->anchorCol = k->caretCol = maxi(c0 - backs, 0);
+    k->version = b->version;
+    b->cursor = block_cursor(k, b);
+}
+
+// Starts a block at row/col, or moves its caret corner there.
+static void block_set(Block *k, const Buffer *b, bool start, int row, int col) {
+    if (start) { k->active = true; k->anchorRow = row; k->anchorCol = col; }
+    k->caretRow = clampi(row, 0, total_rows(b) - 1);
+    k->caretCol = maxi(col, 0);
+    k->version = b->version;
+}
+
+// Leaves block mode once something else moved the cursor or changed the text.
+static void block_check(Block *k, const Buffer *b) {
+    if (k->active && (b->version != k->version || b->cursor != block_cursor(k, b))) k->active = false;
+}
+
+// Highlights the block on one drawn stretch of row `row`, columns
+// [segCol0, segCol1) starting at x0; the last stretch of a row also covers the
+// space past its end. Draws the block's caret column too.
+static void block_draw(const Block *k, const Buffer *b, int row, int segCol0, int segCol1, bool lastSeg,
+                       float x0, float clipL, float clipR, float y, float fontSize, float charW,
+                       Color selBg, Color caret, bool caretOn) {
+    int r0, r1, c0, c1;
+    block_bounds(k, b, &r0, &r1, &c0, &c1);
+    if (row < r0 || row > r1) return;
+    int hiA = maxi(c0, segCol0), hiZ = lastSeg ? c1 : mini(c1, segCol1);
+    float x1 = x0 + (hiA - segCol0) * charW, x2 = x0 + (hiZ - segCol0) * charW;
+    if (x1 < clipL) x1 = clipL;
+    if (x2 > clipR) x2 = clipR;
+    if (x2 > x1) DrawRectangle((int)x1, (int)(y + 3), (int)(x2 - x1), (int)(fontSize + 6), selBg);
+    if (caretOn && k->caretCol >= segCol0 && (k->caretCol < segCol1 || lastSeg)) {
+        float cx = x0 + (k->caretCol - segCol0) * charW;
+        if (cx >= clipL - 1 && cx <= clipR) DrawRectangle((int)cx, (int)(y + 4), 2, (int)(fontSize + 4), caret);
+    }
+}
+
+// Everything typed this frame, Tab as four spaces. Alt chords are shortcuts,
+// not text.
+static int read_typed(char *out, int cap, bool alt) {
+    int n = 0;
+    int ch = GetCharPressed();
+    while (ch > 0 && alt) ch = GetCharPressed();
+    while (ch > 0) {
+        if (ch == 9 && n + 4 <= cap) {
+            memcpy(out + n, "    ", 4);
+            n += 4;
+        } else if (ch >= 32 && ch <= 126 && n < cap) {
+            out[n++] = (char)ch;
+        }
+        ch = GetCharPressed();
+    }
+    return n;
+}
+
+static bool save_to_path(const char *path, const Buffer *buf) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return false;
+    size_t wrote = fwrite(buf->data, 1, (size_t)buf->len, f);
+    fclose(f);
+    return wrote == (size_t)buf->len;
+}
+
+// Reads path as the whole text and rebuilds the line index; undo, cursor
+// and selection are the caller's business.
+static bool buf_read_file(Buffer *buf, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+
+    if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return false; }
+    long size = ftell(f);
+    if (size < 0) { fclose(f); return false; }
+    if (fseek(f, 0, SEEK_SET) != 0) { fclose(f); return false; }
+
+    buf_ensure(buf, (int)size + 1);
+    if (!buf->data) { fclose(f); return false; }
+
+    size_t got = fread(buf->data, 1, (size_t)size, f);
+    fclose(f);
+
+    buf->len = (int)got;
+    buf->data[buf->len] = '\0';
+    li_rebuild(&buf->lines, buf->data, buf->len);
+    return true;
+}
+
+static bool load_from_path(const char *path, Buffer *buf, Selection *sel, float *scrollY) {
+    if (!buf_read_file(buf, path)) return false;
+    undo_clear(&buf->undo);
+    buf_touch(buf, 0, INT_MAX, 0);
+    buf->cursor = buf->len;
+    sel_set_single(sel, buf->cursor);
+    if (scrollY) *scrollY = 0.0f;
+    return true;
+}
+
+// What a file looked like when the text last matched it.
+typedef struct {
+    bool valid;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+} FileStamp;
+
+static FileStamp file_stamp(const char *path) {
+    struct stat st;
+    if (!path[0] || stat(path, &st) != 0) return (FileStamp){0};
+    return (FileStamp){ true, st.st_dev, st.st_ino, st.st_size, st.st_mtim };
+}
+
+static bool stamp_same(const FileStamp *a, const FileStamp *b) {
+    return a->valid == b->valid && a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+           a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+// Follows a file that only grew since *disk was taken (the same file, the
+// text still all of its old bytes, the page before the old end unchanged):
+// the new bytes are read onto the end and only their rows are indexed. No
+// undo step is recorded. Updates *disk on success.
+static bool buf_follow_append(Buffer *b, const char *path, FileStamp *disk, const FileStamp *now) {
+    if (!disk->valid || !now->valid || disk->dev != now->dev || disk->ino != now->ino) return false;
+    if (disk->size != b->len || now->size <= disk->size || now->size >= INT_MAX) return false;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    char edge[4096];
+    int k = mini(b->len, (int)sizeof(edge));
+    int add = (int)(now->size - disk->size);
+    bool ok = pread(fd, edge, (size_t)k, b->len - k) == k && memcmp(edge, b->data + b->len - k, (size_t)k) == 0;
+    if (ok) {
+        buf_ensure(b, b->len + add + 1);
+        ok = b->data && b->cap > b->len + add;
+    }
+    int got = 0;
+    while (ok && got < add) {
+        ssize_t n = pread(fd, b->data + b->len + got, (size_t)(add - got), b->len + got);
+        if (n <= 0) break;  // cut short meanwhile; keep what arrived
+        got += (int)n;
+    }
+    close(fd);
+    if (!ok || got == 0) return false;
+
+    int at = b->len, row = li_row_of(&b->lines, at);
+    li_on_insert(&b->lines, at, b->data + at, got);
+    b->len += got;
+    b->data[b->len] = '\0';
+    buf_touch(b, row, INT_MAX, 0);
+    *disk = *now;
+    disk->size = b->len;
+    return true;
+}
+
+// Takes a rewritten file as the new text. Where the old and new text share
+// their start and end, the cursor and *topRow keep their place in it; in
+// between they keep their row and column. With keepUndo the old text stays
+// one undo away; otherwise the history, which no longer fits, is cleared.
+static bool buf_follow_rewrite(Buffer *b, const char *path, bool keepUndo, int *topRow) {
+    Buffer nb = {0};
+    buf_init(&nb);
+    if (!nb.data || !buf_read_file(&nb, path)) { buf_free(&nb); return false; }
+
+    int head, tail;
+    text_common(b->data, b->len, nb.data, nb.len, &head, &tail);
+    int oldEnd = b->len - tail;
+    int c = b->cursor;
+    if (c >= oldEnd) {
+        c += nb.len - b->len;
+    } else if (c > head) {
+        int row = mini(li_row_of(&b->lines, c), nb.lines.count - 1);
+        int col = c - li_start(&b->lines, li_row_of(&b->lines, c));
+        int ls = li_start(&nb.lines, row);
+        int le = row + 1 < nb.lines.count ? li_start(&nb.lines, row + 1) - 1 : nb.len;
+        c = ls + mini(col, le - ls);
+        while (c > ls && ((unsigned char)nb.data[c] & 0xC0) == 0x80) c--;
+    }
+    int rowEndOld = li_row_of(&b->lines, oldEnd);
+    if (*topRow > rowEndOld) *topRow += li_row_of(&nb.lines, nb.len - tail) - rowEndOld;
+    *topRow = clampi(*topRow, 0, nb.lines.count - 1);
+
+    unsigned version = b->version;
+    buf_replace_text(b, nb.data, nb.len, nb.lines, c);
+    if (b->version == version) return false;
+    if (!keepUndo) undo_clear(&b->undo);
+    return true;
+}
+
+static int wrap_fit_count(Font font, float fontSize, float maxWidth, const char *s, int n) {
+    if (n <= 0) return 0;
+    int lastSpace = -1;
+
+    char tmp[4096];
+    int limit = (int)sizeof(tmp) - 1;
+    int takeMax = (n < limit) ? n : limit;
+
+    for (int i = 0; i < takeMax; i++) {
+        tmp[i] = s[i];
+        tmp[i+1] = '\0';
+        if (s[i] == ' ') lastSpace = i;
+
+        float w = MeasureTextEx(font, tmp, fontSize, 0).x;
+        if (w > maxWidth) {
+            if (lastSpace >= 0) return lastSpace + 1;
+            return (i > 0) ? i : 1;
+        }
+    }
+    return takeMax;
+}
+
+static const char *base_name(const char *p) {
+    if (!p || !p[0]) return p;
+    const char *a = strrchr(p, '/');
+    const char *b = strrchr(p, '\\');
+    const char *m = a;
+    if (b && (!m || b > m)) m = b;
+    return m ? (m + 1) : p;
+}
+
+static void draw_text(Font f, const char *s, float x, float y, float size, Color c) {
+    DrawTextEx(f, s, (Vector2){x,y}, size, 0, c);
+}
+
+static bool ui_button(Rectangle r, const char *label, Font font, float fontSize,
+                      Color bg, Color hover, Color pressed, Color fg) {
+    Vector2 m = GetMousePosition();
+    bool hot = CheckCollisionPointRec(m, r);
+    bool down = hot && IsMouseButtonDown(MOUSE_LEFT_BUTTON);
+
+    Color c = bg;
+    if (hot) c = hover;
+    if (down) c = pressed;
+
+    DrawRectangleRounded(r, 0.25f, 10, c);
+    DrawRectangleRoundedLines(r, 0.25f, 10, (Color){35,42,54,255});
+
+    Vector2 t = MeasureTextEx(font, label, fontSize, 0);
+    DrawTextEx(font, label,
+               (Vector2){ r.x + (r.width - t.x)/2.0f, r.y + (r.height - t.y)/2.0f },
+               fontSize, 0, fg);
+
+    return hot && IsMouseButtonReleased(MOUSE_LEFT_BUTTON);
+}
+
+static bool menu_item_lr(Rectangle r, const char *left, const char *right,
+                         Font font, float fontSize, Color fg) {
+    Vector2 m = GetMousePosition();
+    bool hot = CheckCollisionPointRec(m, r);
+    Color bg = hot ? (Color){33,39,49,255} : (Color){28,33,41,255};
+    DrawRectangleRec(r, bg);
+
+    draw_text(font, left, r.x + 10, r.y + (r.height - fontSize)/2.0f - 1, fontSize, fg);
+
+    if (right && right[0]) {
+        Vector2 tw = MeasureTextEx(font, right, fontSize, 0);
+        draw_text(font, right, r.x + r.width - 10 - tw.x, r.y + (r.height - fontSize)/2.0f - 1, fontSize, fg);
+    }
+    return hot && IsMouseButtonReleased(MOUSE_LEFT_BUTTON);
+}
+
+typedef enum { MENU_NONE, MENU_FILE, MENU_EDIT, MENU_VIEW } Menu;
+
+static void restore_cursor_now(void) {
+    EnableCursor();
+    ShowCursor();
+    SetMouseCursor(MOUSE_CURSOR_DEFAULT);
+}
+
+// --- Key repeat ---
+// Held keys fire once on press, then after a delay at a fixed rate. A poll
+// reports how many times a key fired since the last frame, so a slow frame
+// hands back a burst that the caller applies as one operation.
+typedef enum {
+    REPEAT_BACKSPACE, REPEAT_DELETE, REPEAT_ENTER,
+    REPEAT_LEFT, REPEAT_RIGHT, REPEAT_UP, REPEAT_DOWN,
+    REPEAT_PAGE_UP, REPEAT_PAGE_DOWN,
+    REPEAT_COUNT
+} RepeatKey;
+
+static const int repeatKeyCodes[REPEAT_COUNT] = {
+    KEY_BACKSPACE, KEY_DELETE, KEY_ENTER,
+    KEY_LEFT, KEY_RIGHT, KEY_UP, KEY_DOWN,
+    KEY_PAGE_UP, KEY_PAGE_DOWN,
+};
+
+#define KEY_REPEAT_MAX_BURST 64
+
+typedef struct {
+    double delay, rate;
+    bool held[REPEAT_COUNT];
+    double next[REPEAT_COUNT];
+} KeyRepeat;
+
+// Delay and rate default to 320 ms / 45 ms; PEN_KEY_REPEAT="delay,rate" in
+// milliseconds overrides them.
+static void key_repeat_init(KeyRepeat *kr) {
+    *kr = (KeyRepeat){ .delay = 0.32, .rate = 0.045 };
+    const char *env = getenv("PEN_KEY_REPEAT");
+    int delayMs = 0, rateMs = 0;
+    if (env && sscanf(env, "%d,%d", &delayMs, &rateMs) == 2 && delayMs >= 0 && rateMs > 0) {
+        kr->delay = delayMs / 1000.0;
+        kr->rate = rateMs / 1000.0;
+    }
+}
+
+static void key_repeat_reset(KeyRepeat *kr) { memset(kr->held, 0, sizeof(kr->held)); }
+
+static int key_repeat_poll(KeyRepeat *kr, RepeatKey k, double now) {
+    int key = repeatKeyCodes[k];
+    if (IsKeyPressed(key)) {
+        kr->held[k] = true;
+        kr->next[k] = now + kr->delay;
+        return 1;
+    }
+    if (!IsKeyDown(key)) { kr->held[k] = false; return 0; }
+    if (!kr->held[k] || now < kr->next[k]) return 0;
+
+    int n = 1 + (int)((now - kr->next[k]) / kr->rate);
+    if (n > KEY_REPEAT_MAX_BURST) {
+        // After a long stall, resume the cadence from now rather than
+        // replaying every missed repeat.
+        kr->next[k] = now + kr->rate;
+        return KEY_REPEAT_MAX_BURST;
+    }
+    kr->next[k] += n * kr->rate;
+    return n;
+}
+
+// --- Scrolling ---
+// The view's first row is fractional, so scrolling moves in pixels. Wheel
+// notches add velocity that decays each frame; the scrollbar thumb sets the
+// position directly. Any row is one line-index lookup away, so jumping the
+// thumb across a huge file costs the same as a small step.
+#define SCROLL_IMPULSE  30.0f
+#define SCROLL_FRICTION 10.0f
+#define SCROLLBAR_W     8.0f
+#define SCROLLBAR_MIN_THUMB 24.0f
+
+typedef struct {
+    float pos;
+    float vel;
+    bool dragging;
+    float grab;
+} Scroller;
+
+static void scroll_to(Scroller *s, float row, int maxScroll) {
+    s->pos = clampf(row, 0.0f, (float)maxScroll);
+    s->vel = 0.0f;
+}
+
+static void scroll_step(Scroller *s, float dt, int maxScroll) {
+    if (s->vel != 0.0f) {
+        s->pos += s->vel * dt;
+        s->vel *= expf(-SCROLL_FRICTION * dt);
+        if (fabsf(s->vel) < 0.5f) s->vel = 0.0f;
+    }
+    if (s->pos <= 0.0f || s->pos >= (float)maxScroll) {
+        s->pos = clampf(s->pos, 0.0f, (float)maxScroll);
+        s->vel = 0.0f;
+    }
+}
+
+static Rectangle scrollbar_track(Rectangle card) {
+    return (Rectangle){ card.x + card.width - SCROLLBAR_W - 6, card.y + 14, SCROLLBAR_W, card.height - 28 };
+}
+
+static Rectangle scrollbar_thumb(Rectangle track, float pos, int visibleRows, int rows) {
+    float h = clampf(track.height * (float)visibleRows / (float)maxi(rows, 1), SCROLLBAR_MIN_THUMB, track.height);
+    int maxScroll = maxi(rows - visibleRows, 0);
+    float t = maxScroll > 0 ? pos / (float)maxScroll : 0.0f;
+    return (Rectangle){ track.x, track.y + (track.height - h) * t, track.width, h };
+}
+
+// Returns true when the press landed on the scrollbar. A press off the thumb
+// centres the thumb under the pointer and keeps dragging from there.
+static bool scrollbar_input(Scroller *s, Rectangle track, int visibleRows, int rows, Vector2 mouse) {
+    int maxScroll = rows - visibleRows;
+    if (maxScroll <= 0) { s->dragging = false; return false; }
+
+    Rectangle thumb = scrollbar_thumb(track, s->pos, visibleRows, rows);
+    Rectangle hit = { track.x - 4, track.y, track.width + 8, track.height };
+    bool pressed = IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && CheckCollisionPointRec(mouse, hit);
+    if (pressed) {
+        s->dragging = true;
+        s->grab = (mouse.y >= thumb.y && mouse.y < thumb.y + thumb.height) ? mouse.y - thumb.y : thumb.height / 2.0f;
+    }
+    if (s->dragging) {
+        if (!IsMouseButtonDown(MOUSE_LEFT_BUTTON)) { s->dragging = false; return pressed; }
+        float span = track.height - thumb.height;
+        float t = span > 0.0f ? (mouse.y - s->grab - track.y) / span : 0.0f;
+        scroll_to(s, clampf(t, 0.0f, 1.0f) * (float)maxScroll, maxScroll);
+    }
+    return pressed;
+}
+
+static void scrollbar_draw(const Scroller *s, Rectangle track, int visibleRows, int rows, Vector2 mouse, Color idle, Color active) {
+    if (rows <= visibleRows) return;
+    Rectangle thumb = scrollbar_thumb(track, s->pos, visibleRows, rows);
+    bool hot = s->dragging || CheckCollisionPointRec(mouse, (Rectangle){ track.x - 4, track.y, track.width + 8, track.height });
+    DrawRectangleRounded(thumb, 1.0f, 6, hot ? active : idle);
+}
+
+// --- Toast helper ---
+typedef struct {
+    char msg[128];
+    double until;
+} Toast;
+
+static void toast_set(Toast *t, const char *msg, double seconds) {
+    strncpy(t->msg, msg, sizeof(t->msg) - 1);
+    t->msg[sizeof(t->msg) - 1] = '\0';
+    t->until = GetTime() + seconds;
+}
+
+// --- Syntax highlighting ---
+// The lexers are line at a time: each takes the state a row starts in and
+// returns the state the next row starts in, so states[] (one byte per row) is
+// all that has to be kept. After an edit, relexing resumes at the first
+// touched row and stops at the first row past the edit whose computed start
+// state equals the cached one; everything below is then already right.
+// Visible rows are brought up to date before drawing, the rest a slice at a
+// time per frame. Rows longer than SYN_LINE_MAX are drawn plain and keep the
+// state they start in.
+#define SYN_LINE_MAX (64 << 10)
+
+typedef enum { LANG_NONE, LANG_C, LANG_JSON, LANG_CSV, LANG_TSV, LANG_LOG } SynLang;
+
+typedef enum {
+    SYN_TEXT, SYN_KEYWORD, SYN_TYPE, SYN_STRING, SYN_NUMBER, SYN_COMMENT, SYN_PREPROC,
+    SYN_KEY, SYN_PUNCT, SYN_ERROR, SYN_WARN, SYN_INFO, SYN_DEBUG, SYN_TIME,
+    SYN_COL0, SYN_COL1, SYN_COL2, SYN_COL3,
+    SYN_STYLES
+} SynStyle;
+
+// SYN_TEXT takes the editor's text color.
+static const Color synColors[SYN_STYLES] = {
+    [SYN_KEYWORD] = { 198, 120, 221, 255 }, [SYN_TYPE]    = {  86, 182, 194, 255 },
+    [SYN_STRING]  = { 152, 195, 121, 255 }, [SYN_NUMBER]  = { 209, 154, 102, 255 },
+    [SYN_COMMENT] = { 106, 115, 130, 255 }, [SYN_PREPROC] = { 229, 192, 123, 255 },
+    [SYN_KEY]     = {  97, 175, 239, 255 }, [SYN_PUNCT]   = { 150, 160, 175, 255 },
+    [SYN_ERROR]   = { 239,  83,  80, 255 }, [SYN_WARN]    = { 229, 192, 123, 255 },
+    [SYN_INFO]    = { 125, 211, 252, 255 }, [SYN_DEBUG]   = { 106, 115, 130, 255 },
+    [SYN_TIME]    = { 150, 160, 175, 255 },
+    [SYN_COL0]    = { 230, 233, 240, 255 }, [SYN_COL1]    = { 125, 211, 252, 255 },
+    [SYN_COL2]    = { 152, 195, 121, 255 }, [SYN_COL3]    = { 229, 192, 123, 255 },
+};
+
+// C-like lexer states.
+enum { SYN_C_CODE, SYN_C_BLOCK_COMMENT };
+
+static const char *const synKeywords[] = {
+    "if", "else", "for", "while", "do", "switch", "case", "default", "break", "continue", "return",
+    "goto", "struct", "union", "enum", "typedef", "static", "extern", "const", "volatile", "inline",
+    "sizeof", "class", "public", "private", "protected", "virtual", "template", "typename",
+    "namespace", "using", "new", "delete", "this", "true", "false", "NULL", "nullptr", "try",
+    "catch", "throw", "function", "var", "let", "import", "export", "from", "package", "func",
+    "fn", "mut", "impl", "trait", "pub", "use", "match", "loop", "async", "await", "yield",
+    "interface", "extends", "implements", "final", "override", "self", "super", "null", "nil",
+    "undefined", "typeof", "instanceof", "in", "of", "defer", "go", "select", "chan", "type",
+};
+
+static const char *const synTypes[] = {
+    "void", "char", "short", "int", "long", "float", "double", "signed", "unsigned", "bool",
+    "auto", "size_t", "ssize_t", "ptrdiff_t", "int8_t", "int16_t", "int32_t", "int64_t",
+    "uint8_t", "uint16_t", "uint32_t", "uint64_t", "intptr_t", "uintptr_t", "string", "boolean",
+    "byte", "i8", "i16", "i32", "i64", "u8", "u16", "u32", "u64", "f32", "f64", "usize", "isize",
+    "str", "String", "Self",
+};
+
+static bool syn_word_in(const char *const *list, int count, const char *s, int n) {
+    for (int i = 0; i < count; i++)
+        if ((int)strlen(list[i]) == n && memcmp(list[i], s, (size_t)n) == 0) return true;
+    return false;
+}
+
+static bool syn_ident_char(unsigned char c) { return isalnum(c) || c == '_' || c >= 0x80; }
+
+static void syn_fill(unsigned char *out, int a, int z, SynStyle st) {
+    if (out && z > a) memset(out + a, st, (size_t)(z - a));
+}
+
+// Returns the end of the quoted run opening at s[i], or n if it runs off the row.
+static int syn_quoted(const char *s, int n, int i) {
+    char q = s[i];
+    for (int j = i + 1; j < n; j++) {
+        if (s[j] == '\\') j++;
+        else if (s[j] == q) return j + 1;
+    }
+    return n;
+}
+
+static int syn_number_end(const char *s, int n, int i) {
+    int j = i + 1;
+    while (j < n) {
+        unsigned char c = (unsigned char)s[j];
+        if (isalnum(c) || c == '.' || c == '_') j++;
+        else if ((c == '+' || c == '-') && strchr("eEpP", s[j - 1])) j++;
+        else break;
+    }
+    return j;
+}
+
+static unsigned char syn_lex_c(unsigned char st, const char *s, int n, unsigned char *out, int stop) {
+    bool lead = true;
+    int i = 0;
+    while (i < n && i < stop) {
+        if (st == SYN_C_BLOCK_COMMENT) {
+            int j = i;
+            while (j + 1 < n && !(s[j] == '*' && s[j + 1] == '/')) j++;
+            int end = (j + 1 < n) ? j + 2 : n;
+            if (j + 1 < n) st = SYN_C_CODE;
+            syn_fill(out, i, end, SYN_COMMENT);
+            i = end;
+            lead = false;
+            continue;
+        }
+
+        unsigned char c = (unsigned char)s[i];
+        int end = i + 1;
+        SynStyle style = SYN_TEXT;
+        if (c == '/' && i + 1 < n && s[i + 1] == '/') {
+            syn_fill(out, i, n, SYN_COMMENT);
+            return st;
+        } else if (c == '/' && i + 1 < n && s[i + 1] == '*') {
+            st = SYN_C_BLOCK_COMMENT;
+            end = i + 2;
+            style = SYN_COMMENT;
+        } else if (c == '"' || c == '\'' || c == '`') {
+            end = syn_quoted(s, n, i);
+            style = SYN_STRING;
+        } else if (c == '#' && lead) {
+            while (end < n && (s[end] == ' ' || s[end] == '\t')) end++;
+            while (end < n && syn_ident_char((unsigned char)s[end])) end++;
+            style = SYN_PREPROC;
+        } else if (isdigit(c) || (c == '.' && i + 1 < n && isdigit((unsigned char)s[i + 1]))) {
+            end = syn_number_end(s, n, i);
+            style = SYN_NUMBER;
+        } else if (syn_ident_char(c)) {
+            while (end < n && syn_ident_char((unsigned char)s[end])) end++;
+            // Only drawing needs to know which words are keywords.
+            if (out) {
+                if (syn_word_in(synKeywords, (int)(sizeof(synKeywords) / sizeof(synKeywords[0])), s + i, end - i)) style = SYN_KEYWORD;
+                else if (syn_word_in(synTypes, (int)(sizeof(synTypes) / sizeof(synTypes[0])), s + i, end - i)) style = SYN_TYPE;
+            }
+        } else if (strchr("{}[]();,", c) && c) {
+            style = SYN_PUNCT;
+        }
+        if (c != ' ' && c != '\t') lead = false;
+        syn_fill(out, i, end, style);
+        i = end;
+    }
+    return st;
+}
+
+// JSON strings cannot span rows, so every row starts fresh.
+static unsigned char syn_lex_json(const char *s, int n, unsigned char *out, int stop) {
+    int i = 0;
+    while (i < n && i < stop) {
+        unsigned char c = (unsigned char)s[i];
+        int end = i + 1;
+        SynStyle style = SYN_TEXT;
+        if (c == '"') {
+            end = syn_quoted(s, n, i);
+            int k = end;
+            while (k < n && (s[k] == ' ' || s[k] == '\t')) k++;
+            style = (k < n && s[k] == ':') ? SYN_KEY : SYN_STRING;
+        } else if (isdigit(c) || c == '-') {
+            end = syn_number_end(s, n, i);
+            style = SYN_NUMBER;
+        } else if (isalpha(c)) {
+            while (end < n && isalpha((unsigned char)s[end])) end++;
+            style = SYN_KEYWORD;
+        } else if (strchr("{}[]:,", c) && c) {
+            style = SYN_PUNCT;
+        }
+        syn_fill(out, i, end, style);
+        i = end;
+    }
+    return 0;
+}
+
+// CSV state: bit 0 is "inside a quoted field", which can run over several
+// rows; the column of that field (mod 4, for its color) sits above it.
+static unsigned char syn_lex_csv(unsigned char st, char delim, const char *s, int n, unsigned char *out, int stop) {
+    bool quoted = st & 1;
+    int col = quoted ? st >> 1 : 0;
+    int i = 0;
+    while (i < n && i < stop) {
+        SynStyle style = (SynStyle)(SYN_COL0 + col);
+        int end = i + 1;
+        if (quoted) {
+            end = i;
+            while (end < n) {
+                if (s[end] == '"' && end + 1 < n && s[end + 1] == '"') end += 2;
+                else if (s[end] == '"') { quoted = false; end++; break; }
+                else end++;
+            }
+        } else if (s[i] == delim) {
+            style = SYN_PUNCT;
+            col = (col + 1) & 3;
+        } else if (s[i] == '"') {
+            quoted = true;
+        }
+        syn_fill(out, i, end, style);
+        i = end;
+    }
+    return quoted ? (unsigned char)(1 | col << 1) : 0;
+}
+
+// Log state: the level of the last record, which indented continuation rows
+// (stack traces and the like) are drawn in.
+enum { LEVEL_NONE, LEVEL_ERROR, LEVEL_WARN, LEVEL_INFO, LEVEL_DEBUG };
+
+static int syn_log_level(const char *s, int n) {
+    static const struct { const char *w; int level; } words[] = {
+        { "ERROR", LEVEL_ERROR }, { "ERR", LEVEL_ERROR }, { "FATAL", LEVEL_ERROR }, { "CRITICAL", LEVEL_ERROR },
+        { "CRIT", LEVEL_ERROR }, { "PANIC", LEVEL_ERROR }, { "SEVERE", LEVEL_ERROR },
+        { "WARN", LEVEL_WARN }, { "WARNING", LEVEL_WARN },
+        { "INFO", LEVEL_INFO }, { "NOTICE", LEVEL_INFO },
+        { "DEBUG", LEVEL_DEBUG }, { "TRACE", LEVEL_DEBUG }, { "VERBOSE", LEVEL_DEBUG },
+    };
+    for (int i = 0; i < (int)(sizeof(words) / sizeof(words[0])); i++)
+        if ((int)strlen(words[i].w) == n && strncasecmp(words[i].w, s, (size_t)n) == 0) return words[i].level;
+    return LEVEL_NONE;
+}
+
+static const SynStyle synLogStyles[] = { SYN_TEXT, SYN_ERROR, SYN_WARN, SYN_INFO, SYN_DEBUG };
+
+static unsigned char syn_lex_log(unsigned char st, const char *s, int n, unsigned char *out, int stop) {
+    if (n > 0 && (s[0] == ' ' || s[0] == '\t')) {
+        syn_fill(out, 0, n, (st == LEVEL_ERROR || st == LEVEL_WARN) ? synLogStyles[st] : SYN_TEXT);
+        return st;
+    }
+
+    // A leading timestamp: digits and the separators dates and times use.
+    int i = 0, digits = 0;
+    while (i < n && strchr("0123456789-:.,/TZ+ []", s[i]) && s[i]) digits += isdigit((unsigned char)s[i++]) != 0;
+    while (i > 0 && s[i - 1] == ' ') i--;
+    if (digits >= 4) syn_fill(out, 0, i, SYN_TIME);
+    else i = 0;
+
+    int level = LEVEL_NONE;
+    while (i < n && i < stop) {
+        unsigned char c = (unsigned char)s[i];
+        int end = i + 1;
+        SynStyle style = SYN_TEXT;
+        if (isalpha(c)) {
+            while (end < n && isalpha((unsigned char)s[end])) end++;
+            int l = level == LEVEL_NONE ? syn_log_level(s + i, end - i) : LEVEL_NONE;
+            if (l != LEVEL_NONE) { level = l; style = synLogStyles[l]; }
+        } else if (isdigit(c)) {
+            end = syn_number_end(s, n, i);
+            style = SYN_NUMBER;
+        } else if (c == '"') {
+            end = syn_quoted(s, n, i);
+            style = SYN_STRING;
+        }
+        syn_fill(out, i, end, style);
+        i = end;
+    }
+    // Stopped short, the level word may still be further on.
+    if (stop < n) {
+        for (int k = 0; k < n && level == LEVEL_NONE; k++) {
+            if (!isalpha((unsigned char)s[k]) || (k > 0 && isalpha((unsigned char)s[k - 1]))) continue;
+            int e = k;
+            while (e < n && isalpha((unsigned char)s[e])) e++;
+            level = syn_log_level(s + k, e - k);
+        }
+    }
+    return (unsigned char)level;
+}
+
+// Lexes one row starting in state st. With out, styles for s[0..stop) (and
+// possibly a little past it) are written there; the returned state is only
+// meaningful when the whole row was lexed.
+static unsigned char syn_lex(SynLang lang, unsigned char st, const char *s, int n, unsigned char *out, int stop) {
+    if (n > SYN_LINE_MAX) return st;
+    switch (lang) {
+        case LANG_C:    return syn_lex_c(st, s, n, out, stop);
+        case LANG_JSON: return syn_lex_json(s, n, out, stop);
+        case LANG_CSV:  return syn_lex_csv(st, ',', s, n, out, stop);
+        case LANG_TSV:  return syn_lex_csv(st, '\t', s, n, out, stop);
+        case LANG_LOG:  return syn_lex_log(st, s, n, out, stop);
+        default:        return st;
+    }
+}
+
+// By extension first; files without a known one get a look at their start.
+static SynLang syn_lang_for(const char *path, const Buffer *b) {
+    static const struct { const char *ext; SynLang lang; } exts[] = {
+        { "c", LANG_C }, { "h", LANG_C }, { "cc", LANG_C }, { "cpp", LANG_C }, { "cxx", LANG_C },
+        { "hpp", LANG_C }, { "hh", LANG_C }, { "hxx", LANG_C }, { "m", LANG_C }, { "mm", LANG_C },
+        { "java", LANG_C }, { "js", LANG_C }, { "mjs", LANG_C }, { "cjs", LANG_C }, { "jsx", LANG_C },
+        { "ts", LANG_C }, { "tsx", LANG_C }, { "cs", LANG_C }, { "go", LANG_C }, { "rs", LANG_C },
+        { "swift", LANG_C }, { "kt", LANG_C }, { "scala", LANG_C }, { "dart", LANG_C }, { "zig", LANG_C },
+        { "glsl", LANG_C }, { "vert", LANG_C }, { "frag", LANG_C }, { "proto", LANG_C },
+        { "json", LANG_JSON }, { "jsonc", LANG_JSON }, { "geojson", LANG_JSON },
+        { "csv", LANG_CSV }, { "tsv", LANG_TSV }, { "tab", LANG_TSV }, { "log", LANG_LOG },
+    };
+    const char *name = base_name(path);
+    const char *dot = name ? strrchr(name, '.') : NULL;
+    if (dot) {
+        for (int i = 0; i < (int)(sizeof(exts) / sizeof(exts[0])); i++)
+            if (strcasecmp(dot + 1, exts[i].ext) == 0) return exts[i].lang;
+    }
+
+    int i = 0, n = mini(b->len, 4096);
+    while (i < n && isspace((unsigned char)b->data[i])) i++;
+    if (i < n && (b->data[i] == '{' || b->data[i] == '[')) return LANG_JSON;
+    int e = line_end_index(b, 0);
+    return (e > 0 && syn_lex_log(LEVEL_NONE, b->data, mini(e, 256), NULL, 0) != LEVEL_NONE) ? LANG_LOG : LANG_NONE;
+}
+
+typedef struct {
+    SynLang lang;
+    unsigned char *states;  // the state each row starts in
+    int count, cap;         // rows, as of the last syn_edit()
+    int done;               // states[0..done) are current
+    int stopFrom;           // rows from here on hold the states of unchanged text
+    unsigned char *styles;  // one row's styles, for drawing
+    int stylesCap;
+} Syntax;
+
+static void syn_free(Syntax *sx) {
+    free(sx->states);
+    free(sx->styles);
+    *sx = (Syntax){0};
+}
+
+static bool syn_reserve(Syntax *sx, int rows) {
+    if (rows <= sx->cap) return true;
+    int cap = sx->cap ? sx->cap : 1024;
+    while (cap < rows) cap *= 2;
+    unsigned char *p = (unsigned char*)realloc(sx->states, (size_t)cap);
+    if (!p) return false;
+    sx->states = p;
+    sx->cap = cap;
+    return true;
+}
+
+// Forgets every state; lexing starts over from the top.
+static void syn_set_lang(Syntax *sx, SynLang lang, int rows) {
+    sx->lang = lang;
+    sx->count = sx->done = sx->stopFrom = 0;
+    if (lang == LANG_NONE || !syn_reserve(sx, rows)) { sx->lang = LANG_NONE; return; }
+    memset(sx->states, 0, (size_t)rows);
+    sx->count = sx->stopFrom = rows;
+    sx->done = 1;
+}
+
+// Follows an edit: rows before rowA are untouched, and so is the text of the
+// last tail rows, whose cached states move with them.
+static void syn_edit(Syntax *sx, int rowA, int tail, int rows) {
+    if (sx->lang == LANG_NONE) return;
+    if (!syn_reserve(sx, rows)) { syn_set_lang(sx, LANG_NONE, 0); return; }
+    int old = sx->count;
+    rowA = clampi(rowA, 0, mini(old, rows) - 1);
+    tail = clampi(tail, 0, mini(old, rows) - rowA - 1);
+
+    memmove(sx->states + rows - tail, sx->states + old - tail, (size_t)tail);
+    if (rows - tail > rowA + 1) memset(sx->states + rowA + 1, 0, (size_t)(rows - tail - rowA - 1));
+
+    // A pass still open from an earlier edit keeps its own stop row.
+    int stop = rows - tail;
+    if (sx->done < old) {
+        int prev = sx->stopFrom >= old - tail ? sx->stopFrom + rows - old : sx->stopFrom;
+        stop = maxi(stop, mini(prev, rows));
+    }
+    sx->count = rows;
+    sx->stopFrom = stop;
+    sx->done = mini(sx->done, rowA + 1);
+}
+
+// Lexes rows until the start state of row `until` is known, the whole file
+// is, or the deadline passes. Returns whether `until` is known.
+static bool syn_run(Syntax *sx, const Buffer *b, int until, double deadline) {
+    if (sx->lang == LANG_NONE || sx->count != total_rows(b)) return false;
+    int steps = 0;
+    while (sx->done < sx->count && sx->done <= until) {
+        int r = sx->done - 1;
+        int s = line_start_index(b, r), e = line_end_index(b, s);
+        unsigned char st = syn_lex(sx->lang, sx->states[r], b->data + s, e - s, NULL, e - s);
+        if (sx->done >= sx->stopFrom && sx->states[sx->done] == st) { sx->done = sx->count; break; }
+        sx->states[sx->done++] = st;
+        // Rows past stopFrom must stay one unbroken chain of old states.
+        sx->stopFrom = maxi(sx->stopFrom, sx->done);
+        if ((++steps & 63) == 0 && GetTime() > deadline) break;
+    }
+    return sx->done > until || sx->done >= sx->count;
+}
+
+// Styles for the first `upTo` bytes of a row, or NULL to draw it plain. A row
+// the lexer has not reached yet is styled from its cached state, which is
+// usually right and fixed a frame or so later if not.
+static const unsigned char *syn_row_styles(Syntax *sx, const Buffer *b, int row, int ls, int le, int upTo) {
+    int n = le - ls;
+    if (sx->lang == LANG_NONE || sx->count != total_rows(b) || row >= sx->count || n == 0 || n > SYN_LINE_MAX) return NULL;
+    if (n > sx->stylesCap) {
+        unsigned char *p = (unsigned char*)realloc(sx->styles, (size_t)n);
+        if (!p) return NULL;
+        sx->styles = p;
+        sx->stylesCap = n;
+    }
+    memset(sx->styles, SYN_TEXT, (size_t)n);
+    syn_lex(sx->lang, sx->states[row], b->data + ls, n, sx->styles, mini(upTo, n));
+    return sx->styles;
+}
+
+// --- Glyph batch ---
+// Editor text is gathered as one textured quad per glyph, each with its own
+// color, and submitted once the viewport is laid out. However many style runs
+// a row breaks into, the text costs one texture bind and, batch size
+// permitting, one draw. Glyphs sit on the monospace grid, charW per codepoint.
+#define GLYPH_CHUNK 1024
+
+typedef struct { float x, y; int glyph; Color color; } GlyphQuad;
+
+typedef struct {
+    Font font;
+    float scale;
+    int ascii[128];     // glyph index of each ASCII codepoint
+    GlyphQuad *q;
+    int count, cap;
+} GlyphBatch;
+
+static void glyphs_init(GlyphBatch *gb, Font font, float fontSize) {
+    *gb = (GlyphBatch){ .font = font, .scale = fontSize / (float)font.baseSize };
+    for (int c = 0; c < 128; c++) gb->ascii[c] = GetGlyphIndex(font, c);
+}
+
+static void glyphs_free(GlyphBatch *gb) {
+    free(gb->q);
+    gb->q = NULL;
+    gb->count = gb->cap = 0;
+}
+
+// Decodes one UTF-8 sequence from s[0..n) and returns its length; a malformed
+// byte comes back on its own as U+FFFD.
+static int utf8_next(const unsigned char *s, int n, int *cp) {
+    int len = s[0] < 0x80 ? 1 : (s[0] & 0xE0) == 0xC0 ? 2 : (s[0] & 0xF0) == 0xE0 ? 3 : (s[0] & 0xF8) == 0xF0 ? 4 : 0;
+    if (len == 1) { *cp = s[0]; return 1; }
+    if (len == 0 || len > n) { *cp = 0xFFFD; return 1; }
+    int v = s[0] & (0x7F >> len);
+    for (int i = 1; i < len; i++) {
+        if ((s[i] & 0xC0) != 0x80) { *cp = 0xFFFD; return 1; }
+        v = (v << 6) | (s[i] & 0x3F);
+    }
+    *cp = v;
+    return len;
+}
+
+// Queues s[0..n) at pos; styles (per byte, may be NULL) pick each glyph's
+// color, SYN_TEXT meaning plain.
+static void glyphs_add(GlyphBatch *gb, const char *s, int n, const unsigned char *styles, Vector2 pos,
+                       float charW, Color plain) {
+    int col = 0;
+    for (int i = 0; i < n; col++) {
+        int cp, k = utf8_next((const unsigned char*)s + i, n - i, &cp);
+        if (cp != ' ' && cp != '\t') {
+            if (gb->count == gb->cap) {
+                int cap = gb->cap ? gb->cap * 2 : 4096;
+                GlyphQuad *p = (GlyphQuad*)realloc(gb->q, sizeof(GlyphQuad) * (size_t)cap);
+                if (!p) return;
+                gb->q = p;
+                gb->cap = cap;
+            }
+            Color c = (!styles || styles[i] == SYN_TEXT) ? plain : synColors[styles[i]];
+            int glyph = cp < 128 ? gb->ascii[cp] : GetGlyphIndex(gb->font, cp);
+            gb->q[gb->count++] = (GlyphQuad){ pos.x + col * charW, pos.y, glyph, c };
+        }
+        i += k;
+    }
+}
+
+// Emits every queued glyph, in chunks the render batch is known to hold.
+static void glyphs_flush(GlyphBatch *gb) {
+    const Font *f = &gb->font;
+    float tw = (float)f->texture.width, th = (float)f->texture.height;
+    float pad = (float)f->glyphPadding, s = gb->scale;
+    for (int a = 0; a < gb->count; a += GLYPH_CHUNK) {
+        int z = mini(a + GLYPH_CHUNK, gb->count);
+        rlCheckRenderBatchLimit(4 * (z - a));
+        rlSetTexture(f->texture.id);
+        rlBegin(RL_QUADS);
+        rlNormal3f(0.0f, 0.0f, 1.0f);
+        for (int i = a; i < z; i++) {
+            const GlyphQuad *g = &gb->q[i];
+            Rectangle r = f->recs[g->glyph];
+            float x = g->x + (f->glyphs[g->glyph].offsetX - pad) * s;
+            float y = g->y + (f->glyphs[g->glyph].offsetY - pad) * s;
+            float w = (r.width + 2.0f * pad) * s, h = (r.height + 2.0f * pad) * s;
+            float u0 = (r.x - pad) / tw, v0 = (r.y - pad) / th;
+            float u1 = (r.x + r.width + pad) / tw, v1 = (r.y + r.height + pad) / th;
+            rlColor4ub(g->color.r, g->color.g, g->color.b, g->color.a);
+            rlTexCoord2f(u0, v0); rlVertex2f(x, y);
+            rlTexCoord2f(u0, v1); rlVertex2f(x, y + h);
+            rlTexCoord2f(u1, v1); rlVertex2f(x + w, y + h);
+            rlTexCoord2f(u1, v0); rlVertex2f(x + w, y);
+        }
+        rlEnd();
+        rlSetTexture(0);
+    }
+    gb->count = 0;
+}
+
+// --- Minimap ---
+// One pixel row per linesPerPx document rows, two columns per pixel. Each pixel
+// row is built from a fixed number of sampled lines, so a full rebuild costs
+// the same on a 500k-line file as on a short one; edits only re-dirty the pixel
+// rows they map to, and dirty rows are rebuilt a slice at a time per frame.
+#define MINIMAP_W       96
+#define MINIMAP_SAMPLES 4
+
+typedef struct {
+    Texture2D tex;
+    Color *px;
+    int texH;
+    int linesPerPx;
+    int usedPx;
+    int dirtyA, dirtyZ;
+} Minimap;
+
+static void mm_free(Minimap *m) {
+    if (m->tex.id) UnloadTexture(m->tex);
+    free(m->px);
+    *m = (Minimap){0};
+}
+
+static void mm_dirty(Minimap *m, int pa, int pz) {
+    pa = clampi(pa, 0, m->texH);
+    pz = clampi(pz, 0, m->texH);
+    if (pz <= pa) return;
+    if (m->dirtyZ <= m->dirtyA) { m->dirtyA = pa; m->dirtyZ = pz; return; }
+    m->dirtyA = mini(m->dirtyA, pa);
+    m->dirtyZ = maxi(m->dirtyZ, pz);
+}
+
+static void mm_invalidate_rows(Minimap *m, int rowA, int rowZ) {
+    if (m->linesPerPx <= 0) return;
+    int pz = (rowZ == INT_MAX) ? m->texH : (rowZ + m->linesPerPx - 1) / m->linesPerPx;
+    mm_dirty(m, rowA / m->linesPerPx, pz);
+}
+
+// Fits the texture to the strip height and the row->pixel mapping to the
+// current row count; anything that changes the mapping dirties everything.
+static void mm_layout(Minimap *m, int texH, int rows) {
+    if (texH < 1) texH = 1;
+    if (texH != m->texH || !m->px) {
+        mm_free(m);
+        m->px = (Color*)calloc((size_t)MINIMAP_W * (size_t)texH, sizeof(Color));
+        if (!m->px) return;
+        Image img = { .data = m->px, .width = MINIMAP_W, .height = texH, .mipmaps = 1,
+                      .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        m->tex = LoadTextureFromImage(img);
+        m->texH = texH;
+    }
+
+    int lpp = (rows + texH - 1) / texH;
+    if (lpp < 1) lpp = 1;
+    int used = (rows + lpp - 1) / lpp;
+    if (lpp != m->linesPerPx) { m->linesPerPx = lpp; mm_dirty(m, 0, texH); }
+    if (used != m->usedPx) { mm_dirty(m, mini(used, m->usedPx), maxi(used, m->usedPx)); m->usedPx = used; }
+}
+
+static void mm_build_row(Minimap *m, const Buffer *b, int p, Color ink) {
+    Color *out = m->px + (size_t)p * MINIMAP_W;
+    memset(out, 0, sizeof(Color) * MINIMAP_W);
+    if (p >= m->usedPx) return;
+
+    unsigned char hits[MINIMAP_W] = {0};
+    int rowA = p * m->linesPerPx;
+    int rowZ = mini(rowA + m->linesPerPx, total_rows(b));
+    int step = maxi(1, (rowZ - rowA) / MINIMAP_SAMPLES);
+    int samples = 0;
+
+    for (int row = rowA; row < rowZ && samples < MINIMAP_SAMPLES; row += step, samples++) {
+        int s = line_start_index(b, row);
+        int n = mini(line_end_index(b, s) - s, MINIMAP_W * 2);
+        for (int i = 0; i < n; i++) {
+            unsigned char c = (unsigned char)b->data[s + i];
+            if (c > ' ') hits[i >> 1]++;
+        }
+    }
+    if (samples == 0) return;
+
+    for (int x = 0; x < MINIMAP_W; x++) {
+        if (!hits[x]) continue;
+        out[x] = ink;
+        out[x].a = (unsigned char)(ink.a * hits[x] / (samples * 2));
+    }
+}
+
+// Rebuilds dirty pixel rows until the frame's budget runs out, then uploads
+// just the span that changed.
+static void mm_update(Minimap *m, const Buffer *b, Color ink, double budget) {
+    if (!m->px || m->dirtyZ <= m->dirtyA) return;
+
+    double deadline = GetTime() + budget;
+    int from = m->dirtyA, p = from;
+    while (p < m->dirtyZ) {
+        mm_build_row(m, b, p, ink);
+        p++;
+        if ((p & 15) == 0 && GetTime() > deadline) break;
+    }
+
+    UpdateTextureRec(m->tex, (Rectangle){ 0, (float)from, MINIMAP_W, (float)(p - from) },
+                     m->px + (size_t)from * MINIMAP_W);
+    m->dirtyA = p;
+}
+
+// --- Line-number gutter ---
+// Width is only recomputed when the digit count of the row total changes, and
+// labels are formatted once per row into a small row-keyed slot table.
+#define GUTTER_SLOTS 256
+
+typedef struct {
+    int digits;
+    float width;
+    int row[GUTTER_SLOTS];
+    char label[GUTTER_SLOTS][12];
+    int labelLen[GUTTER_SLOTS];
+} Gutter;
+
+static void gutter_init(Gutter *g) {
+    g->digits = 0;
+    g->width = 0.0f;
+    for (int i = 0; i < GUTTER_SLOTS; i++) g->row[i] = -1;
+}
+
+static float gutter_width(Gutter *g, int rows, float charW) {
+    int d = 1;
+    for (int v = rows; v >= 10; v /= 10) d++;
+    if (d != g->digits) {
+        g->digits = d;
+        g->width = (float)(maxi(d, 2) + 2) * charW;
+    }
+    return g->width;
+}
+
+static void gutter_draw(Gutter *g, GlyphBatch *gb, float charW, float right, float y, int row, Color c) {
+    int slot = row & (GUTTER_SLOTS - 1);
+    if (g->row[slot] != row) {
+        g->labelLen[slot] = snprintf(g->label[slot], sizeof(g->label[slot]), "%d", row + 1);
+        g->row[slot] = row;
+    }
+    glyphs_add(gb, g->label[slot], g->labelLen[slot], NULL, (Vector2){ right - g->labelLen[slot] * charW, y }, charW, c);
+}
+
+// --- Documents ---
+// Every open file is a Doc with its own text, undo, selection, scroll and
+// lexer states. Fonts, the glyph batch, the gutter and the minimap are shared
+// and only ever show the active one. main() edits the active document in its
+// own locals: activating a tab parks their state back in the old Doc and
+// moves the new one's in (DocLive points at the locals), so the rest of the
+// loop never has to know which tab it is working on. A restored session only
+// records path, cursor and scroll per tab; the file is read the first time
+// its tab is activated.
+//
+// When the total goes over the memory budget (PEN_MEMORY_BUDGET, in MiB),
+// inactive documents give their text back, least recently used first. A
+// clean one just drops it and reads its file again on activation; a dirty
+// one is written to the swap file, an unlinked scratch file in the cache
+// dir, and read back from there. Undo history and selections stay in memory.
+#define TAB_H     24
+#define TAB_MIN_W 72
+#define TAB_MAX_W 200
+#define MEMORY_BUDGET_MB 512
+
+typedef enum { DOC_RESIDENT, DOC_DROPPED, DOC_SPILLED } DocStore;
+
+// What activating a document found.
+typedef enum { DOC_OK, DOC_UNREADABLE, DOC_RELOADED } DocLoad;
+
+typedef struct {
+    char path[512];
+    bool hasPath, dirty;
+    bool loaded;            // false until the first activation reads the file
+    int restoreCursor;      // where that first activation puts the cursor
+    DocStore store;
+    long swapAt;            // where a spilled text sits in the swap file
+    FileStamp disk;         // the file as it was when the text last matched it
+    double lastActive;
+    size_t bytes;           // heap held while parked
+    Buffer buf;
+    Selection sel;
+    Scroller scroll;
+    float scrollX;
+    int desiredCol;
+    Carets carets;
+    Block block;
+    Syntax syntax;
+} Doc;
+
+// The locals main() keeps the active document in.
+typedef struct {
+    Buffer *buf;
+    Selection *sel;
+    Scroller *scroll;
+    float *scrollX;
+    int *desiredCol;
+    Carets *carets;
+    Block *block;
+    Syntax *syntax;
+    char *path;
+    int pathSz;
+    bool *hasPath, *dirty;
+    FileStamp *disk;
+} DocLive;
+
+typedef struct { long at, len; } SwapExtent;
+
+typedef struct {
+    bool open;
+    int fd;
+    long end;
+    SwapExtent *holes;      // freed ranges, reused first fit
+    int holeCount, holeCap;
+    int spilled;            // documents with text in the file
+} SwapFile;
+
+typedef struct {
+    Doc *docs;
+    int count, cap;
+    int active;
+    size_t budget;
+    SwapFile swap;
+} Tabs;
+
+static void doc_free(Doc *d) {
+    buf_free(&d->buf);
+    carets_free(&d->carets);
+    syn_free(&d->syntax);
+}
+
+static size_t doc_bytes(const Buffer *b, const Syntax *sx, const Carets *c) {
+    size_t n = (size_t)sx->cap + (size_t)sx->stylesCap + sizeof(Selection) * (size_t)c->cap;
+    if (b->data) n += (size_t)b->cap + sizeof(int) * (size_t)b->lines.cap;
+    n += sizeof(UndoStep) * (size_t)b->undo.cap;
+    for (int i = 0; i < b->undo.count; i++) {
+        const UndoStep *st = &b->undo.steps[i];
+        n += (size_t)st->removedLen + (size_t)st->insertedLen + sizeof(int) * (3 * (size_t)st->spanCount + (size_t)st->lines.cap);
+    }
+    return n;
+}
+
+static void swap_close(SwapFile *s) {
+    if (s->open) close(s->fd);
+    free(s->holes);
+    *s = (SwapFile){0};
+}
+
+static bool swap_write(SwapFile *s, const char *data, int len, long *at) {
+    if (!s->open) {
+        char dir[768], path[1024];
+        const char *xdg = getenv("XDG_CACHE_HOME");
+        const char *home = getenv("HOME");
+        if (xdg && xdg[0]) snprintf(dir, sizeof(dir), "%s/pen", xdg);
+        else if (home && home[0]) snprintf(dir, sizeof(dir), "%s/.cache/pen", home);
+        else snprintf(dir, sizeof(dir), "/tmp");
+        snprintf(path, sizeof(path), "%s/swap-%d", dir, (int)getpid());
+        s->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (s->fd < 0) return false;
+        unlink(path);
+        s->open = true;
+    }
+
+    *at = s->end;
+    int hole = -1;
+    for (int i = 0; i < s->holeCount; i++) if (s->holes[i].len >= len) { hole = i; break; }
+    if (hole >= 0) {
+        *at = s->holes[hole].at;
+        s->holes[hole].at += len;
+        s->holes[hole].len -= len;
+    }
+    for (long done = 0; done < len;) {
+        ssize_t w = pwrite(s->fd, data + done, (size_t)(len - done), *at + done);
+        if (w <= 0) {
+            if (hole >= 0) { s->holes[hole].at -= len; s->holes[hole].len += len; }
+            return false;
+        }
+        done += w;
+    }
+    if (hole < 0) s->end += len;
+    s->spilled++;
+    return true;
+}
+
+// Gives a spilled range back; with nothing left in the file it is emptied.
+static void swap_release(SwapFile *s, long at, int len) {
+    if (--s->spilled <= 0) {
+        if (ftruncate(s->fd, 0) != 0) {}
+        s->end = 0;
+        s->holeCount = 0;
+        s->spilled = 0;
+        return;
+    }
+    if (s->holeCount == s->holeCap) {
+        int cap = s->holeCap ? s->holeCap * 2 : 16;
+        SwapExtent *p = (SwapExtent*)realloc(s->holes, sizeof(SwapExtent) * (size_t)cap);
+        if (!p) return;
+        s->holes = p;
+        s->holeCap = cap;
+    }
+    s->holes[s->holeCount++] = (SwapExtent){ at, len };
+}
+
+static void doc_text_free(Doc *d) {
+    free(d->buf.data);
+    d->buf.data = NULL;
+    d->buf.cap = 0;
+    li_free(&d->buf.lines);
+    d->bytes = doc_bytes(&d->buf, &d->syntax, &d->carets);
+}
+
+// A clean text can go if the file is untouched since it last matched.
+static bool doc_drop(Doc *d) {
+    FileStamp now = file_stamp(d->path);
+    if (d->dirty || !d->hasPath || !now.valid || !stamp_same(&now, &d->disk) || now.size != d->buf.len) return false;
+    d->store = DOC_DROPPED;
+    doc_text_free(d);
+    return true;
+}
+
+static bool doc_spill(Doc *d, SwapFile *s) {
+    if (!swap_write(s, d->buf.data, d->buf.len, &d->swapAt)) return false;
+    d->store = DOC_SPILLED;
+    doc_text_free(d);
+    return true;
+}
+
+// Brings a dropped or spilled text back. A dropped file that changed since
+// is read as it now is, with the history that no longer fits it cleared.
+static DocLoad doc_restore(Doc *d, SwapFile *s) {
+    Buffer *b = &d->buf;
+    int len = b->len;
+    b->cap = maxi(len + 1, 1024);
+    b->data = (char*)malloc((size_t)b->cap);
+    li_init(&b->lines);
+    DocStore from = d->store;
+    d->store = DOC_RESIDENT;
+    if (!b->data) { b->cap = b->len = 0; return DOC_UNREADABLE; }
+
+    bool ok = true, same = true;
+    if (from == DOC_SPILLED) {
+        for (long done = 0; ok && done < len;) {
+            ssize_t got = pread(s->fd, b->data + done, (size_t)(len - done), d->swapAt + done);
+            ok = got > 0;
+            done += ok ? got : 0;
+        }
+        swap_release(s, d->swapAt, len);
+    } else {
+        FileStamp now = file_stamp(d->path);
+        same = stamp_same(&now, &d->disk);
+        ok = buf_read_file(b, d->path);
+        len = b->len;
+        if (ok) d->disk = now;
+    }
+    b->len = ok ? len : 0;
+    b->data[b->len] = '\0';
+    if (from == DOC_SPILLED || !ok) li_rebuild(&b->lines, b->data, b->len);
+    if (ok && same) return DOC_OK;
+
+    undo_clear(&b->undo);
+    buf_touch(b, 0, INT_MAX, 0);
+    b->cursor = clampi(b->cursor, 0, b->len);
+    sel_set_single(&d->sel, b->cursor);
+    carets_clear(&d->carets);
+    d->block.active = false;
+    syn_set_lang(&d->syntax, d->syntax.lang, total_rows(b));
+    return ok ? DOC_RELOADED : DOC_UNREADABLE;
+}
+
+// Appends an empty, untitled document; its text is allocated on activation.
+static Doc *tabs_push(Tabs *t) {
+    if (t->count == t->cap) {
+        int cap = t->cap ? t->cap * 2 : 8;
+        Doc *p = (Doc*)realloc(t->docs, sizeof(Doc) * (size_t)cap);
+        if (!p) return NULL;
+        t->docs = p;
+        t->cap = cap;
+    }
+    Doc *d = &t->docs[t->count++];
+    *d = (Doc){0};
+    return d;
+}
+
+static void doc_park(Doc *d, const DocLive *l) {
+    d->buf = *l->buf;
+    d->sel = *l->sel;
+    d->scroll = *l->scroll;
+    d->scroll.vel = 0.0f;
+    d->scroll.dragging = false;
+    d->scrollX = *l->scrollX;
+    d->desiredCol = *l->desiredCol;
+    d->carets = *l->carets;
+    d->block = *l->block;
+    d->syntax = *l->syntax;
+    snprintf(d->path, sizeof(d->path), "%s", l->path);
+    d->hasPath = *l->hasPath;
+    d->dirty = *l->dirty;
+    d->disk = *l->disk;
+    d->loaded = true;
+    d->store = DOC_RESIDENT;
+    d->lastActive = GetTime();
+    d->bytes = doc_bytes(&d->buf, &d->syntax, &d->carets);
+}
+
+// Moves d into the live locals, reading its file first if it has never been
+// active and bringing back a text given up to the budget. DOC_UNREADABLE
+// leaves the tab empty.
+static DocLoad doc_unpark(Doc *d, const DocLive *l, SwapFile *s) {
+    DocLoad res = DOC_OK;
+    if (d->store != DOC_RESIDENT) res = doc_restore(d, s);
+    if (!d->loaded) {
+        buf_init(&d->buf);
+        d->disk = file_stamp(d->hasPath ? d->path : "");
+        if (d->hasPath && !load_from_path(d->path, &d->buf, &d->sel, NULL)) res = DOC_UNREADABLE;
+        d->buf.cursor = clampi(d->restoreCursor, 0, d->buf.len);
+        sel_set_single(&d->sel, d->buf.cursor);
+        syn_set_lang(&d->syntax, syn_lang_for(d->path, &d->buf), total_rows(&d->buf));
+        d->loaded = true;
+    }
+    *l->buf = d->buf;
+    *l->sel = d->sel;
+    *l->scroll = d->scroll;
+    *l->scrollX = d->scrollX;
+    *l->desiredCol = d->desiredCol;
+    *l->carets = d->carets;
+    *l->block = d->block;
+    *l->syntax = d->syntax;
+    snprintf(l->path, (size_t)l->pathSz, "%s", d->path);
+    *l->hasPath = d->hasPath;
+    *l->dirty = d->dirty;
+    *l->disk = d->disk;
+    return res;
+}
+
+static DocLoad tabs_activate(Tabs *t, int to, const DocLive *l) {
+    if (to < 0 || to >= t->count || to == t->active) return DOC_OK;
+    doc_park(&t->docs[t->active], l);
+    t->active = to;
+    return doc_unpark(&t->docs[to], l, &t->swap);
+}
+
+// Closes tab i; the last tab closed leaves a fresh untitled one. Closing the
+// active tab activates tab next (an index from before the close), or with
+// next < 0 the neighbour that takes its place.
+static DocLoad tabs_close(Tabs *t, int i, int next, const DocLive *l) {
+    if (i < 0 || i >= t->count) return DOC_OK;
+    if (i == t->active) {
+        buf_free(l->buf);
+        carets_free(l->carets);
+        syn_free(l->syntax);
+    } else {
+        if (t->docs[i].store == DOC_SPILLED) swap_release(&t->swap, t->docs[i].swapAt, t->docs[i].buf.len);
+        doc_free(&t->docs[i]);
+    }
+    memmove(t->docs + i, t->docs + i + 1, sizeof(Doc) * (size_t)(t->count - i - 1));
+    t->count--;
+
+    if (t->count == 0) tabs_push(t);
+    if (i == t->active) {
+        t->active = next < 0 || next == i ? mini(i, t->count - 1) : next - (next > i);
+        t->active = clampi(t->active, 0, t->count - 1);
+        return doc_unpark(&t->docs[t->active], l, &t->swap);
+    }
+    if (i < t->active) t->active--;
+    return DOC_OK;
+}
+
+static void tabs_free(Tabs *t) {
+    for (int i = 0; i < t->count; i++) if (i != t->active) doc_free(&t->docs[i]);
+    free(t->docs);
+    swap_close(&t->swap);
+    *t = (Tabs){0};
+}
+
+static void tabs_set_budget(Tabs *t) {
+    const char *env = getenv("PEN_MEMORY_BUDGET");
+    long mb = env ? atol(env) : 0;
+    t->budget = (size_t)(mb > 0 ? mb : MEMORY_BUDGET_MB) << 20;
+}
+
+// Heap held by all documents, the active one counted as liveBytes.
+static size_t tabs_total(const Tabs *t, size_t liveBytes) {
+    size_t total = liveBytes;
+    for (int i = 0; i < t->count; i++) if (i != t->active) total += t->docs[i].bytes;
+    return total;
+}
+
+// Gives inactive texts back until the total fits the budget: clean ones
+// before dirty ones, least recently active first within each.
+static void tabs_trim(Tabs *t, size_t liveBytes) {
+    size_t total = tabs_total(t, liveBytes);
+    while (total > t->budget) {
+        int pick = -1;
+        bool pickClean = false;
+        for (int i = 0; i < t->count; i++) {
+            const Doc *d = &t->docs[i];
+            if (i == t->active || !d->loaded || d->store != DOC_RESIDENT || !d->buf.data) continue;
+            bool clean = !d->dirty && d->hasPath;
+            if (pick < 0 || (clean && !pickClean) || (clean == pickClean && d->lastActive < t->docs[pick].lastActive)) {
+                pick = i;
+                pickClean = clean;
+            }
+        }
+        if (pick < 0) return;
+
+        Doc *d = &t->docs[pick];
+        size_t before = d->bytes;
+        if (!(pickClean && doc_drop(d)) && !doc_spill(d, &t->swap)) return;
+        total -= before - d->bytes;
+    }
+}
+
+static void doc_load_note(Toast *toast, DocLoad r) {
+    if (r == DOC_UNREADABLE) toast_set(toast, "Could not open file", 1.5);
+    else if (r == DOC_RELOADED) toast_set(toast, "File changed on disk: reloaded", 2.0);
+}
+
+static void format_bytes(char *out, size_t outSz, size_t n) {
+    if (n < (1u << 20)) snprintf(out, outSz, "%.1f KB", (double)n / 1024.0);
+    else snprintf(out, outSz, "%.1f MB", (double)n / (1024.0 * 1024.0));
+}
+
+// Whether any document has unsaved changes, the active one's flag given.
+static bool tabs_any_dirty(const Tabs *t, bool liveDirty) {
+    if (liveDirty) return true;
+    for (int i = 0; i < t->count; i++) if (i != t->active && t->docs[i].dirty) return true;
+    return false;
+}
+
+static int tabs_find(const Tabs *t, const char *path, const DocLive *l) {
+    for (int i = 0; i < t->count; i++) {
+        bool has = i == t->active ? *l->hasPath : t->docs[i].hasPath;
+        const char *p = i == t->active ? l->path : t->docs[i].path;
+        if (has && strcmp(p, path) == 0) return i;
+    }
+    return -1;
+}
+
+// Sessions live in $XDG_STATE_HOME/pen/session: a header, the active tab,
+// then "cursor scrollRow path" per tab. Untitled tabs are not kept.
+static bool session_path(char *out, size_t outSz) {
+    char dir[768];
+    const char *xdg = getenv("XDG_STATE_HOME");
+    const char *home = getenv("HOME");
+    if (xdg && xdg[0]) snprintf(dir, sizeof(dir), "%s", xdg);
+    else if (home && home[0]) snprintf(dir, sizeof(dir), "%s/.local/state", home);
+    else return false;
+
+    mkdir(dir, 0755);
+    strncat(dir, "/pen", sizeof(dir) - strlen(dir) - 1);
+    mkdir(dir, 0755);
+    snprintf(out, outSz, "%s/session", dir);
+    return true;
+}
+
+static void session_save(const Tabs *t, const DocLive *l) {
+    char path[1024], tmp[1100];
+    if (!session_path(path, sizeof(path))) return;
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    FILE *out = fopen(tmp, "w");
+    if (!out) return;
+
+    int kept = 0, active = 0;
+    for (int i = 0; i < t->count; i++) if (i < t->active && t->docs[i].hasPath) active++;
+    fprintf(out, "pen-session 1\nactive %d\n", active);
+    for (int i = 0; i < t->count; i++) {
+        const Doc *d = &t->docs[i];
+        bool live = i == t->active;
+        if (!(live ? *l->hasPath : d->hasPath)) continue;
+        int cursor = live ? l->buf->cursor : d->loaded ? d->buf.cursor : d->restoreCursor;
+        int row = (int)(live ? l->scroll->pos : d->scroll.pos);
+        fprintf(out, "%d %d %s\n", cursor, row, live ? l->path : d->path);
+        kept++;
+    }
+    bool ok = fclose(out) == 0;
+    if (ok && kept > 0) rename(tmp, path);
+    else { remove(tmp); if (ok) remove(path); }
+}
+
+// Adds the saved tabs, unread, and returns the one to activate (or -1).
+static int session_load(Tabs *t) {
+    char path[1024];
+    if (!session_path(path, sizeof(path))) return -1;
+    FILE *in = fopen(path, "r");
+    if (!in) return -1;
+
+    int active = -1, first = t->count;
+    char line[1100];
+    if (fgets(line, sizeof(line), in) && strcmp(line, "pen-session 1\n") == 0 &&
+        fgets(line, sizeof(line), in) && sscanf(line, "active %d", &active) == 1) {
+        while (fgets(line, sizeof(line), in)) {
+            int cursor, row, used = 0;
+            if (sscanf(line, "%d %d %n", &cursor, &row, &used) != 2 || used == 0) continue;
+            line[strcspn(line, "\n")] = '\0';
+            if (!line[used] || strlen(line + used) >= sizeof(((Doc*)0)->path)) continue;
+            Doc *d = tabs_push(t);
+            if (!d) break;
+            snprintf(d->path, sizeof(d->path), "%s", line + used);
+            d->hasPath = true;
+            d->restoreCursor = cursor;
+            d->scroll.pos = (float)maxi(row, 0);
+        }
+    }
+    fclose(in);
+    if (t->count == first) return -1;
+    return first + clampi(active, 0, t->count - first - 1);
+}
+
+// Tab strip along the top of the card, scrolled so the active tab shows.
+// Sets *activate or *close to a tab index when one was clicked (middle click
+// or the x closes).
+static void tabs_draw(const Tabs *t, const DocLive *l, float x, float y, float width, bool enabled,
+                      Font font, float fontSize, Color text, Color muted, Color accent, Color border,
+                      int *activate, int *close) {
+    *activate = *close = -1;
+    float tabW = clampf(width / (float)t->count, TAB_MIN_W, TAB_MAX_W);
+    int fits = maxi(1, (int)(width / tabW));
+    int first = maxi(0, t->active - fits + 1);
+    Vector2 m = GetMousePosition();
+    for (int i = first; i < t->count && i < first + fits; i++, x += tabW) {
+        bool live = i == t->active;
+        const char *path = live ? l->path : t->docs[i].path;
+        bool hasPath = live ? *l->hasPath : t->docs[i].hasPath;
+        bool dirty = live ? *l->dirty : t->docs[i].dirty;
+
+        Rectangle r = { x, y, tabW - 4, TAB_H };
+        Rectangle xr = { r.x + r.width - 20, r.y + 4, 16, 16 };
+        bool hot = CheckCollisionPointRec(m, r);
+        DrawRectangleRounded(r, 0.25f, 8, live ? (Color){ 28, 33, 41, 255 } : hot ? (Color){ 24, 29, 37, 255 } : (Color){ 20, 24, 31, 255 });
+        DrawRectangleRoundedLines(r, 0.25f, 8, border);
+        if (live) DrawRectangle((int)r.x + 6, (int)(r.y + r.height - 2), (int)r.width - 12, 2, accent);
+
+        char label[96];
+        snprintf(label, sizeof(label), "%s%s", dirty ? "* " : "", hasPath ? base_name(path) : "untitled");
+        BeginScissorMode((int)r.x + 8, (int)r.y, (int)r.width - 30, (int)r.height);
+        draw_text(font, label, r.x + 8, r.y + (r.height - fontSize) / 2.0f, fontSize, live ? text : muted);
+        EndScissorMode();
+        draw_text(font, "x", xr.x + 4, xr.y - 1, fontSize, CheckCollisionPointRec(m, xr) ? text : muted);
+
+        if (!enabled || !hot) continue;
+        if (IsMouseButtonPressed(MOUSE_MIDDLE_BUTTON) ||
+            (IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && CheckCollisionPointRec(m, xr))) *close = i;
+        else if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) *activate = i;
+    }
+}
+
+// --- Dialog backend probing ---
+// tinyfiledialogs works out which backend to use (zenity, kdialog, ...) the
+// first time a dialog is requested, then keeps the answers in statics. A
+// "tinyfd_query" call on a helper thread at startup pays for that off the UI
+// thread; dialogs join the probe before touching tinyfd themselves.
+static pthread_t dialogProbe;
+static bool dialogProbeRunning = false;
+static pthread_mutex_t dialogProbeLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *dialog_probe_main(void *arg) {
+    (void)arg;
+    tinyfd_openFileDialog("tinyfd_query", "", 0, NULL, NULL, 0);
+    tinyfd_saveFileDialog("tinyfd_query", "", 0, NULL, NULL);
+    return NULL;
+}
+
+static void dialog_probe_start(void) {
+    dialogProbeRunning = pthread_create(&dialogProbe, NULL, dialog_probe_main, NULL) == 0;
+}
+
+static void dialog_probe_wait(void) {
+    pthread_mutex_lock(&dialogProbeLock);
+    if (dialogProbeRunning) {
+        pthread_join(dialogProbe, NULL);
+        dialogProbeRunning = false;
+    }
+    pthread_mutex_unlock(&dialogProbeLock);
+}
+
+static bool open_path(const char *path, Buffer *buf, Selection *sel, float *scrollY, char *pathOut, int pathOutSz, bool *hasPath) {
+    bool ok = load_from_path(path, buf, sel, scrollY);
+    if (ok) {
+        strncpy(pathOut, path, (size_t)pathOutSz - 1);
+        pathOut[pathOutSz - 1] = '\0';
+        *hasPath = true;
+    }
+    return ok;
+}
+
+static bool save_as_path(const char *path, const Buffer *buf, char *pathOut, int pathOutSz, bool *hasPath) {
+    bool ok = save_to_path(path, buf);
+    if (ok) {
+        strncpy(pathOut, path, (size_t)pathOutSz - 1);
+        pathOut[pathOutSz - 1] = '\0';
+        *hasPath = true;
+    }
+    return ok;
+}
+
+// --- Async file dialogs ---
+// The external dialog runs on a helper thread so the frame loop keeps drawing
+// while zenity/kdialog is up. The chosen path is picked up by polling once the
+// thread has finished; an empty result means the dialog was cancelled.
+enum { DIALOG_IDLE, DIALOG_RUNNING, DIALOG_DONE };
+
+typedef struct {
+    pthread_t thread;
+    bool saving;
+    char suggest[PATH_MAX];
+    char result[PATH_MAX];
+    atomic_int state;
+} AsyncDialog;
+
+static void *async_dialog_main(void *arg) {
+    AsyncDialog *d = (AsyncDialog*)arg;
+    dialog_probe_wait();
+    const char *path = d->saving
+        ? tinyfd_saveFileDialog("Save As", d->suggest, 0, NULL, NULL)
+        : tinyfd_openFileDialog("Open text file", "", 0, NULL, NULL, 0);
+    snprintf(d->result, sizeof(d->result), "%s", path ? path : "");
+    atomic_store(&d->state, DIALOG_DONE);
+    return NULL;
+}
+
+static bool async_dialog_start(AsyncDialog *d, bool saving, const char *suggest) {
+    if (atomic_load(&d->state) != DIALOG_IDLE) return false;
+    d->saving = saving;
+    snprintf(d->suggest, sizeof(d->suggest), "%s", suggest ? suggest : "");
+    d->result[0] = '\0';
+    atomic_store(&d->state, DIALOG_RUNNING);
+    if (pthread_create(&d->thread, NULL, async_dialog_main, d) != 0) { atomic_store(&d->state, DIALOG_IDLE); return false; }
+    return true;
+}
+
+// True once per finished dialog; d->result then holds the path or "".
+static bool async_dialog_poll(AsyncDialog *d) {
+    if (atomic_load(&d->state) != DIALOG_DONE) return false;
+    pthread_join(d->thread, NULL);
+    atomic_store(&d->state, DIALOG_IDLE);
+    return true;
+}
+
+// --- Directory listings ---
+// Entries are read with raw getdents64 in 64 KiB batches and sorted on a
+// worker thread. Finished listings stay in a small cache that an inotify
+// watch marks stale when the directory changes.
+typedef struct {
+    char *names;
+    int namesLen, namesCap;
+    int *offs;
+    unsigned char *isDir;
+    int count, cap;
+} DirListing;
+
+struct pen_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static void dl_free(DirListing *l) {
+    free(l->names); free(l->offs); free(l->isDir);
+    *l = (DirListing){0};
+}
+
+static bool dl_push(DirListing *l, const char *name, bool isDir) {
+    int n = (int)strlen(name) + 1;
+    if (l->namesLen + n > l->namesCap) {
+        int cap = l->namesCap ? l->namesCap : 4096;
+        while (l->namesLen + n > cap) cap *= 2;
+        char *p = (char*)realloc(l->names, (size_t)cap);
+        if (!p) return false;
+        l->names = p; l->namesCap = cap;
+    }
+    if (l->count == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 256;
+        int *o = (int*)realloc(l->offs, sizeof(int) * (size_t)cap);
+        if (!o) return false;
+        l->offs = o;
+        unsigned char *d = (unsigned char*)realloc(l->isDir, (size_t)cap);
+        if (!d) return false;
+        l->isDir = d;
+        l->cap = cap;
+    }
+    memcpy(l->names + l->namesLen, name, (size_t)n);
+    l->offs[l->count] = l->namesLen;
+    l->isDir[l->count] = isDir;
+    l->namesLen += n;
+    l->count++;
+    return true;
+}
+
+static int dl_cmp(const void *pa, const void *pb, void *ctx) {
+    const DirListing *l = (const DirListing*)ctx;
+    int a = *(const int*)pa, b = *(const int*)pb;
+    if (l->isDir[a] != l->isDir[b]) return l->isDir[b] - l->isDir[a];
+    return strcmp(l->names + l->offs[a], l->names + l->offs[b]);
+}
+
+// Directories first, then by name. Sorts an index and permutes into place.
+static void dl_sort(DirListing *l) {
+    if (l->count < 2) return;
+    int *order = (int*)malloc(sizeof(int) * (size_t)l->count);
+    int *offs = (int*)malloc(sizeof(int) * (size_t)l->count);
+    unsigned char *dirs = (unsigned char*)malloc((size_t)l->count);
+    if (order && offs && dirs) {
+        for (int i = 0; i < l->count; i++) order[i] = i;
+        qsort_r(order, (size_t)l->count, sizeof(int), dl_cmp, l);
+        for (int i = 0; i < l->count; i++) { offs[i] = l->offs[order[i]]; dirs[i] = l->isDir[order[i]]; }
+        memcpy(l->offs, offs, sizeof(int) * (size_t)l->count);
+        memcpy(l->isDir, dirs, (size_t)l->count);
+    }
+    free(order); free(offs); free(dirs);
+}
+
+static bool dl_read(const char *path, DirListing *out) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    static _Thread_local char batch[64 * 1024];
+    DirListing l = {0};
+    bool ok = true;
+    for (;;) {
+        long got = syscall(SYS_getdents64, fd, batch, sizeof(batch));
+        if (got < 0) { ok = false; break; }
+        if (got == 0) break;
+        for (long pos = 0; pos < got; ) {
+            struct pen_dirent64 *d = (struct pen_dirent64*)(batch + pos);
+            pos += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+            bool isDir = d->d_type == DT_DIR;
+            if (d->d_type == DT_UNKNOWN || d->d_type == DT_LNK) {
+                struct stat st;
+                isDir = fstatat(fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+            }
+            if (!dl_push(&l, name, isDir)) { ok = false; break; }
+        }
+        if (!ok) break;
+    }
+    close(fd);
+
+    if (!ok) { dl_free(&l); return false; }
+    dl_sort(&l);
+    *out = l;
+    return true;
+}
+
+// One in-flight listing. If the picker moves on before it finishes, whichever
+// side sees the other's state last frees the job.
+enum { DIRLOAD_RUNNING, DIRLOAD_DONE, DIRLOAD_ABANDONED };
+
+typedef struct {
+    pthread_t thread;
+    char path[PATH_MAX];
+    DirListing list;
+    bool ok;
+    atomic_int state;
+} DirLoad;
+
+static void *dirload_main(void *arg) {
+    DirLoad *job = (DirLoad*)arg;
+    job->ok = dl_read(job->path, &job->list);
+    if (atomic_exchange(&job->state, DIRLOAD_DONE) == DIRLOAD_ABANDONED) { dl_free(&job->list); free(job); }
+    return NULL;
+}
+
+static DirLoad *dirload_start(const char *path) {
+    DirLoad *job = (DirLoad*)calloc(1, sizeof(DirLoad));
+    if (!job) return NULL;
+    snprintf(job->path, sizeof(job->path), "%s", path);
+    atomic_init(&job->state, DIRLOAD_RUNNING);
+    if (pthread_create(&job->thread, NULL, dirload_main, job) != 0) { free(job); return NULL; }
+    pthread_detach(job->thread);
+    return job;
+}
+
+static void dirload_abandon(DirLoad *job) {
+    if (!job) return;
+    if (atomic_exchange(&job->state, DIRLOAD_ABANDONED) == DIRLOAD_DONE) { dl_free(&job->list); free(job); }
+}
+
+#define DIRCACHE_SLOTS 8
+
+typedef struct {
+    char path[PATH_MAX];
+    DirListing list;
+    int wd;
+    bool stale;
+    unsigned lastUse;
+} DirCacheEntry;
+
+typedef struct {
+    int inotifyFd;
+    unsigned tick;
+    DirCacheEntry e[DIRCACHE_SLOTS];
+} DirCache;
+
+static void dircache_init(DirCache *c) {
+    memset(c, 0, sizeof(*c));
+    c->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    for (int i = 0; i < DIRCACHE_SLOTS; i++) c->e[i].wd = -1;
+}
+
+static void dircache_free(DirCache *c) {
+    for (int i = 0; i < DIRCACHE_SLOTS; i++) dl_free(&c->e[i].list);
+    if (c->inotifyFd >= 0) close(c->inotifyFd);
+    c->inotifyFd = -1;
+}
+
+// Drains pending inotify events and marks the affected listings stale. Only
+// called while the picker is up; a queue overflow in between marks everything.
+static void dircache_poll(DirCache *c) {
+    if (c->inotifyFd < 0) return;
+    char evbuf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t got = read(c->inotifyFd, evbuf, sizeof(evbuf));
+        if (got <= 0) return;
+        for (char *p = evbuf; p < evbuf + got; ) {
+            struct inotify_event *ev = (struct inotify_event*)p;
+            for (int i = 0; i < DIRCACHE_SLOTS; i++)
+                if (c->e[i].wd == ev->wd || (ev->mask & IN_Q_OVERFLOW)) c->e[i].stale = true;
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+}
+
+static DirCacheEntry *dircache_find(DirCache *c, const char *path) {
+    for (int i = 0; i < DIRCACHE_SLOTS; i++) {
+        if (c->e[i].list.names && strcmp(c->e[i].path, path) == 0) { c->e[i].lastUse = ++c->tick; return &c->e[i]; }
+    }
+    return NULL;
+}
+
+static DirCacheEntry *dircache_store(DirCache *c, const char *path, DirListing list) {
+    DirCacheEntry *e = dircache_find(c, path);
+    if (!e) {
+        e = &c->e[0];
+        for (int i = 1; i < DIRCACHE_SLOTS; i++) if (c->e[i].lastUse < e->lastUse) e = &c->e[i];
+        if (e->wd >= 0 && c->inotifyFd >= 0) inotify_rm_watch(c->inotifyFd, e->wd);
+        e->wd = -1;
+        snprintf(e->path, sizeof(e->path), "%s", path);
+        if (c->inotifyFd >= 0)
+            e->wd = inotify_add_watch(c->inotifyFd, path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                                          IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    }
+    dl_free(&e->list);
+    e->list = list;
+    e->stale = false;
+    e->lastUse = ++c->tick;
+    return e;
+}
+
+// --- File watch ---
+// The open file's directory is watched rather than the file itself, so a
+// writer that replaces the file by rename is noticed as well as one that
+// appends in place. An event only means "look again": the file's stamp
+// against the one taken when the text last matched it decides what changed.
+// Without inotify the file is looked at once a second.
+typedef struct {
+    int fd, wd;
+    char path[PATH_MAX];
+    bool changed;           // an event named the file since the last look
+    bool prompt;            // it changed under unsaved edits; the user decides
+    bool reload;            // the user chose to reload
+    double nextLook;
+} FileWatch;
+
+static void watch_init(FileWatch *w) {
+    memset(w, 0, sizeof(*w));
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    w->wd = -1;
+}
+
+static void watch_free(FileWatch *w) {
+    if (w->fd >= 0) close(w->fd);
+    w->fd = w->wd = -1;
+}
+
+// Points the watch at path ("" for none); the next poll then looks at it
+// whatever happened before the watch was set.
+static void watch_set(FileWatch *w, const char *path) {
+    if (strcmp(w->path, path) == 0) return;
+    if (w->wd >= 0) inotify_rm_watch(w->fd, w->wd);
+    w->wd = -1;
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    w->changed = true;
+    w->prompt = false;
+    if (!path[0] || w->fd < 0) return;
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (!slash) snprintf(dir, sizeof(dir), ".");
+    else if (slash == dir) slash[1] = '\0';
+    else *slash = '\0';
+    w->wd = inotify_add_watch(w->fd, dir, IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE |
+                                          IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+}
+
+// Drains pending events; true if the file may have changed since the last
+// poll that returned true.
+static bool watch_poll(FileWatch *w) {
+    if (w->fd >= 0) {
+        char evbuf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        const char *name = base_name(w->path);
+        ssize_t got;
+        while ((got = read(w->fd, evbuf, sizeof(evbuf))) > 0) {
+            for (char *p = evbuf; p < evbuf + got; ) {
+                struct inotify_event *ev = (struct inotify_event*)p;
+                if ((ev->mask & IN_Q_OVERFLOW) || (ev->wd == w->wd && ev->len && strcmp(ev->name, name) == 0))
+                    w->changed = true;
+                p += sizeof(*ev) + ev->len;
+            }
+        }
+    } else if (GetTime() >= w->nextLook) {
+        w->changed = true;
+        w->nextLook = GetTime() + 1.0;
+    }
+    bool changed = w->changed && w->path[0];
+    w->changed = false;
+    return changed;
+}
+
+// The bar offered along the bottom of the editor while the file changed
+// under unsaved edits.
+static Rectangle watch_box(Rectangle area) {
+    return (Rectangle){ area.x + 12, area.y + area.height - 52, area.width - 24, 40 };
+}
+
+// Returns 1 to reload the file, -1 to keep the edits, 0 while undecided.
+static int watch_prompt_draw(Rectangle area, const char *name, Font font, float fontSize,
+                             Color text, Color muted, Color border) {
+    Rectangle box = watch_box(area);
+    DrawRectangleRounded(box, 0.20f, 10, (Color){28,33,41,255});
+    DrawRectangleRoundedLines(box, 0.20f, 10, border);
+    char label[320];
+    snprintf(label, sizeof(label), "%s changed on disk. Reload and drop your edits (Ctrl+Z brings them back)?", name);
+    draw_text(font, label, box.x + 12, box.y + 11, fontSize, muted);
+
+    Color b0 = (Color){28,33,41,255}, b1 = (Color){33,39,49,255}, b2 = (Color){40,46,58,255};
+    Rectangle bKeep = { box.x + box.width - 104, box.y + 6, 96, 28 };
+    Rectangle bReload = { bKeep.x - 92, box.y + 6, 84, 28 };
+    if (ui_button(bReload, "Reload", font, fontSize, b0, b1, b2, text)) return 1;
+    if (ui_button(bKeep, "Keep mine", font, fontSize, b0, b1, b2, text)) return -1;
+    return 0;
+}
+
+// --- File picker ---
+// In-editor alternative to the external dialogs (View > Built-in File Picker).
+// Typing filters the current directory by subsequence match; extending the
+// query narrows the previous matches instead of rescanning the listing.
+#define PICKER_ROWS 14
+
+typedef enum { PICK_NONE, PICK_CANCEL, PICK_CHOSEN } PickResult;
+
+typedef struct {
+    bool open;
+    bool saving;
+    char dir[PATH_MAX];
+    char query[256];
+    int queryLen;
+    char matchedFor[256];
+    bool matchesValid;
+    int *matches;
+    int matchCount, matchCap;
+    int sel, scroll;
+    DirLoad *load;
+    const DirCacheEntry *shown;
+    PickResult result;
+    char chosen[PATH_MAX];
+    char armed[PATH_MAX];   // an existing file a first Save asked to overwrite
+    double armedUntil;
+} FilePicker;
+
+static bool fuzzy_match(const char *name, const char *q, int qlen, bool *prefix) {
+    *prefix = strncasecmp(name, q, (size_t)qlen) == 0;
+    if (*prefix) return true;
+    for (const char *s = name; *s && qlen > 0; s++) {
+        if (tolower((unsigned char)*s) == tolower((unsigned char)*q)) { q++; qlen--; }
+    }
+    return qlen == 0;
+}
+
+// Prefix matches first, then other subsequence matches. When the query only
+// grew, the candidates are the previous matches rather than the whole listing.
+static void picker_filter(FilePicker *p) {
+    const DirListing *l = p->shown ? &p->shown->list : NULL;
+    if (!l) { p->matchCount = 0; return; }
+    if (p->matchesValid && strcmp(p->matchedFor, p->query) == 0) return;
+
+    if (p->matchCap < l->count) {
+        int *m = (int*)realloc(p->matches, sizeof(int) * (size_t)maxi(l->count, 1));
+        if (!m) { p->matchCount = 0; return; }
+        p->matches = m; p->matchCap = maxi(l->count, 1);
+    }
+
+    bool narrow = p->matchesValid && p->matchedFor[0] && strncmp(p->query, p->matchedFor, strlen(p->matchedFor)) == 0;
+    int nCand = narrow ? p->matchCount : l->count;
+    int *cand = NULL;
+    if (narrow) {
+        cand = (int*)malloc(sizeof(int) * (size_t)maxi(nCand, 1));
+        if (!cand) narrow = false; else memcpy(cand, p->matches, sizeof(int) * (size_t)nCand);
+    }
+    if (!narrow) nCand = l->count;
+
+    bool showHidden = p->query[0] == '.';
+    int out = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int k = 0; k < nCand; k++) {
+            int i = narrow ? cand[k] : k;
+            const char *name = l->names + l->offs[i];
+            if (name[0] == '.' && !showHidden) continue;
+            bool prefix;
+            if (!fuzzy_match(name, p->query, p->queryLen, &prefix)) continue;
+            if (prefix == (pass == 0)) p->matches[out++] = i;
+        }
+    }
+    free(cand);
+
+    p->matchCount = out;
+    snprintf(p->matchedFor, sizeof(p->matchedFor), "%s", p->query);
+    p->matchesValid = true;
+    p->sel = clampi(p->sel, 0, maxi(out - 1, 0));
+}
+
+static void picker_set_dir(FilePicker *p, DirCache *c, const char *dir) {
+    if (p->dir != dir) snprintf(p->dir, sizeof(p->dir), "%s", dir);
+    dirload_abandon(p->load);
+    p->load = NULL;
+    p->shown = dircache_find(c, p->dir);
+    if (!p->shown || p->shown->stale) p->load = dirload_start(p->dir);
+    p->query[0] = '\0'; p->queryLen = 0;
+    p->matchesValid = false;
+    p->sel = p->scroll = 0;
+}
+
+static void picker_open(FilePicker *p, DirCache *c, bool saving, const char *currentPath) {
+    char dir[PATH_MAX] = "";
+    if (currentPath && currentPath[0] == '/') {
+        snprintf(dir, sizeof(dir), "%s", currentPath);
+        char *slash = strrchr(dir, '/');
+        if (slash == dir) slash[1] = '\0'; else if (slash) *slash = '\0';
+    } else if (!getcwd(dir, sizeof(dir))) {
+        snprintf(dir, sizeof(dir), "/");
+    }
+    p->open = true;
+    p->saving = saving;
+    p->result = PICK_NONE;
+    p->armed[0] = '\0';
+    picker_set_dir(p, c, dir);
+    if (saving && currentPath && currentPath[0]) {
+        snprintf(p->query, sizeof(p->query), "%s", base_name(currentPath));
+        p->queryLen = (int)strlen(p->query);
+    }
+}
+
+static void picker_close(FilePicker *p) {
+    dirload_abandon(p->load);
+    p->load = NULL;
+    p->open = false;
+    p->shown = NULL;
+}
+
+static void picker_free(FilePicker *p) { picker_close(p); free(p->matches); p->matches = NULL; p->matchCap = 0; }
+
+static void picker_up(FilePicker *p, DirCache *c) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", p->dir);
+    char *slash = strrchr(dir, '/');
+    if (!slash) return;
+    if (slash == dir) slash[1] = '\0'; else *slash = '\0';
+    picker_set_dir(p, c, dir);
+}
+
+static void picker_join(char *out, size_t sz, const char *dir, const char *name) {
+    size_t n = strlen(dir);
+    snprintf(out, sz, "%s%s%s", dir, (n && dir[n-1] == '/') ? "" : "/", name);
+}
+
+// Enter, or a click on an entry: directories are entered, files are chosen.
+// In save mode a query that names no highlighted directory is the file name.
+static void picker_activate(FilePicker *p, DirCache *c, int matchIdx) {
+    const DirListing *l = p->shown ? &p->shown->list : NULL;
+    bool haveEntry = l && matchIdx >= 0 && matchIdx < p->matchCount;
+    int i = haveEntry ? p->matches[matchIdx] : -1;
+
+    if (haveEntry && l->isDir[i]) {
+        char dir[PATH_MAX];
+        picker_join(dir, sizeof(dir), p->dir, l->names + l->offs[i]);
+        picker_set_dir(p, c, dir);
+        return;
+    }
+    char path[PATH_MAX];
+    if (p->saving && p->queryLen > 0) picker_join(path, sizeof(path), p->dir, p->query);
+    else if (haveEntry) picker_join(path, sizeof(path), p->dir, l->names + l->offs[i]);
+    else return;
+
+    // Saving over an existing file needs a second Save within two seconds.
+    struct stat st;
+    if (p->saving && stat(path, &st) == 0 && !(strcmp(p->armed, path) == 0 && GetTime() < p->armedUntil)) {
+        snprintf(p->armed, sizeof(p->armed), "%s", path);
+        p->armedUntil = GetTime() + 2.0;
+        return;
+    }
+    snprintf(p->chosen, sizeof(p->chosen), "%s", path);
+    p->result = PICK_CHOSEN;
+}
+
+// Picks up finished listings and handles keyboard input while the picker is up.
+static void picker_update(FilePicker *p, DirCache *c) {
+    dircache_poll(c);
+
+    if (p->load && atomic_load(&p->load->state) == DIRLOAD_DONE) {
+        DirLoad *job = p->load;
+        p->load = NULL;
+        if (job->ok) { p->shown = dircache_store(c, job->path, job->list); p->matchesValid = false; }
+        else dl_free(&job->list);
+        free(job);
+    }
+    if (p->shown && p->shown->stale && !p->load) p->load = dirload_start(p->dir);
+
+    int ch = GetCharPressed();
+    while (ch > 0) {
+        if (ch >= 32 && ch <= 126 && p->queryLen < (int)sizeof(p->query) - 1) {
+            p->query[p->queryLen++] = (char)ch;
+            p->query[p->queryLen] = '\0';
+            p->sel = p->scroll = 0;
+        }
+        ch = GetCharPressed();
+    }
+
+    if (IsKeyPressed(KEY_BACKSPACE) || IsKeyPressedRepeat(KEY_BACKSPACE)) {
+        if (p->queryLen > 0) { p->query[--p->queryLen] = '\0'; p->sel = p->scroll = 0; }
+        else picker_up(p, c);
+    }
+
+    picker_filter(p);
+
+    if (IsKeyPressed(KEY_DOWN) || IsKeyPressedRepeat(KEY_DOWN)) p->sel++;
+    if (IsKeyPressed(KEY_UP) || IsKeyPressedRepeat(KEY_UP)) p->sel--;
+    if (IsKeyPressed(KEY_PAGE_DOWN)) p->sel += PICKER_ROWS;
+    if (IsKeyPressed(KEY_PAGE_UP)) p->sel -= PICKER_ROWS;
+    p->sel = clampi(p->sel, 0, maxi(p->matchCount - 1, 0));
+    if (p->sel < p->scroll) p->scroll = p->sel;
+    if (p->sel >= p->scroll + PICKER_ROWS) p->scroll = p->sel - PICKER_ROWS + 1;
+
+    if (IsKeyPressed(KEY_ENTER)) picker_activate(p, c, p->sel);
+    if (IsKeyPressed(KEY_ESCAPE)) p->result = PICK_CANCEL;
+}
+
+static void picker_draw(FilePicker *p, DirCache *c, Rectangle area, Font font, float fontSize,
+                        Color text, Color muted, Color accent, Color border) {
+    float rowH = 28.0f;
+    float boxW = mini(640, (int)area.width - 40);
+    float boxH = rowH * (PICKER_ROWS + 3) + 16;
+    Rectangle box = { area.x + (area.width - boxW) / 2.0f, area.y + 10, boxW, boxH };
+    DrawRectangleRounded(box, 0.04f, 10, (Color){28,33,41,255});
+    DrawRectangleRoundedLines(box, 0.04f, 10, border);
+
+    // Header: directory (left-truncated) and the query line with a caret.
+    const char *dirShown = p->dir;
+    while (strlen(dirShown) > 1 && MeasureTextEx(font, dirShown, fontSize, 0).x > boxW - 20) dirShown++;
+    draw_text(font, dirShown, box.x + 10, box.y + 8, fontSize, muted);
+
+    Rectangle q = { box.x + 8, box.y + rowH + 4, boxW - 16, rowH };
+    DrawRectangleRec(q, (Color){20,24,31,255});
+    const char *hint = p->saving ? "File name" : "Type to filter";
+    if (p->queryLen) draw_text(font, p->query, q.x + 8, q.y + 6, fontSize, text);
+    else draw_text(font, hint, q.x + 8, q.y + 6, fontSize, muted);
+    float qx = q.x + 8 + (p->queryLen ? MeasureTextEx(font, p->query, fontSize, 0).x : 0.0f);
+    DrawRectangle((int)qx + 1, (int)q.y + 5, 2, (int)rowH - 10, accent);
+
+    float wheel = GetMouseWheelMove();
+    if (wheel != 0.0f && CheckCollisionPointRec(GetMousePosition(), box))
+        p->scroll = clampi(p->scroll - (int)wheel * 3, 0, maxi(p->matchCount - PICKER_ROWS, 0));
+
+    const DirListing *l = p->shown ? &p->shown->list : NULL;
+    float listY = q.y + rowH + 6;
+    if (!l) {
+        draw_text(font, p->load ? "Loading..." : "Cannot read this folder", box.x + 14, listY + 6, fontSize, muted);
+    }
+    for (int r = 0; l && r < PICKER_ROWS && p->scroll + r < p->matchCount; r++) {
+        int m = p->scroll + r;
+        int i = p->matches[m];
+        Rectangle rr = { box.x + 4, listY + r * rowH, boxW - 8, rowH };
+        if (menu_item_lr(rr, l->names + l->offs[i], l->isDir[i] ? "folder" : "", font, fontSize, l->isDir[i] ? accent : text)) {
+            p->sel = m;
+            picker_activate(p, c, m);
+        }
+        if (m == p->sel) DrawRectangle((int)rr.x, (int)rr.y + 4, 3, (int)rowH - 8, accent);
+    }
+
+    Rectangle bUp     = { box.x + 8, box.y + boxH - rowH - 8, 70, rowH };
+    Rectangle bCancel = { box.x + boxW - 8 - 2*90 - 8, bUp.y, 90, rowH };
+    Rectangle bOk     = { box.x + boxW - 8 - 90, bUp.y, 90, rowH };
+    Color b0 = (Color){28,33,41,255}, b1 = (Color){33,39,49,255}, b2 = (Color){40,46,58,255};
+    if (ui_button(bUp, "Up", font, fontSize, b0, b1, b2, text)) picker_up(p, c);
+    if (ui_button(bCancel, "Cancel", font, fontSize, b0, b1, b2, text)) p->result = PICK_CANCEL;
+    if (ui_button(bOk, p->saving ? "Save" : "Open", font, fontSize, b0, b1, b2, text)) picker_activate(p, c, p->sel);
+    if (p->armed[0] && GetTime() < p->armedUntil)
+        draw_text(font, "File exists: Save again to overwrite", bUp.x + bUp.width + 12, bUp.y + 6, fontSize,
+                  (Color){ 248, 113, 113, 255 });
+}
+
+// Starts whichever chooser is configured; the path arrives in a later frame.
+static void request_path(bool saving, bool builtin, FilePicker *picker, DirCache *dirCache,
+                         AsyncDialog *dialog, const char *currentPath) {
+    if (builtin) picker_open(picker, dirCache, saving, currentPath);
+    else async_dialog_start(dialog, saving, (currentPath && currentPath[0]) ? currentPath : "untitled.txt");
+}
+
+// --- Go to line ---
+// Ctrl+G opens a one-line prompt for a line number. The jump is a single
+// lookup in the line index, so it costs the same on any file size.
+typedef struct {
+    bool open;
+    char text[12];
+    int len;
+} GotoBar;
+
+typedef enum { GOTO_NONE, GOTO_CANCEL, GOTO_JUMP } GotoResult;
+
+static GotoResult goto_update(GotoBar *g, int *lineOut) {
+    int ch = GetCharPressed();
+    while (ch > 0) {
+        if (ch >= '0' && ch <= '9' && g->len < (int)sizeof(g->text) - 1) {
+            g->text[g->len++] = (char)ch;
+            g->text[g->len] = '\0';
+        }
+        ch = GetCharPressed();
+    }
+    if ((IsKeyPressed(KEY_BACKSPACE) || IsKeyPressedRepeat(KEY_BACKSPACE)) && g->len > 0) g->text[--g->len] = '\0';
+
+    if (IsKeyPressed(KEY_ESCAPE)) return GOTO_CANCEL;
+    if (IsKeyPressed(KEY_ENTER) || IsKeyPressed(KEY_KP_ENTER)) {
+        if (g->len == 0) return GOTO_CANCEL;
+        *lineOut = (int)strtol(g->text, NULL, 10);
+        return GOTO_JUMP;
+    }
+    return GOTO_NONE;
+}
+
+static void goto_draw(const GotoBar *g, Rectangle area, int rows, Font font, float fontSize,
+                      Color text, Color muted, Color accent, Color border) {
+    char label[48];
+    snprintf(label, sizeof(label), "Go to line (1-%d):", rows);
+    float labelW = MeasureTextEx(font, label, fontSize, 0).x;
+    float boxW = labelW + 140;
+    Rectangle box = { area.x + (area.width - boxW) / 2.0f, area.y + 10, boxW, 40 };
+    DrawRectangleRounded(box, 0.20f, 10, (Color){28,33,41,255});
+    DrawRectangleRoundedLines(box, 0.20f, 10, border);
+    draw_text(font, label, box.x + 12, box.y + 11, fontSize, muted);
+
+    float x = box.x + 20 + labelW;
+    draw_text(font, g->text, x, box.y + 11, fontSize, text);
+    float cx = x + (g->len ? MeasureTextEx(font, g->text, fontSize, 0).x : 0.0f);
+    DrawRectangle((int)cx + 1, (int)box.y + 9, 2, 22, accent);
+}
+
+// --- Find bar ---
+// Ctrl+F opens a query line over the editor; Enter finds the next match and
+// Shift+Enter the previous one. Plain queries are escaped into a pattern, so
+// both modes go through the regex engine and its literal skip. Ctrl+H adds a
+// replacement line; Tab moves between the two and Enter there replaces all.
+typedef struct {
+    bool open;
+    char query[256];
+    int len;
+    bool replacing, focusWith;
+    char with[256];
+    int withLen;
+    bool useRegex, matchCase;
+    Regex re;
+    bool compiled;
+    bool stale;
+    const char *err;
+    bool notFound;
+
+    // Matches of the query the hit set was built for, found a slice per frame
+    // from the top of the text. Every match starting before `scanned` is in
+    // hits. Changing the query drops or narrows the set on the next scan.
+    ReMatch *hits;
+    int hitCount, hitCap;
+    int scanned;
+    bool scanDone, capped;
+    bool hitValid;
+    char hitQuery[256];
+    int hitLen;
+    bool hitRegex, hitCase;
+    unsigned hitVersion;
+    // As-you-type searches land on the first match at or after origin.
+    int origin;
+    bool jumpPending;
+} FindBar;
+
+#define FIND_MAX_HITS (1 << 22)
+#define FIND_SCAN_SLICE (256 << 10)
+
+typedef enum { FIND_NONE, FIND_CLOSE, FIND_NEXT, FIND_PREV, FIND_REPLACE_ALL } FindAction;
+
+static void find_free(FindBar *f) {
+    if (f->compiled) regex_free(&f->re);
+    f->compiled = false;
+}
+
+static void find_hits_free(FindBar *f) {
+    free(f->hits);
+    f->hits = NULL;
+    f->hitCount = f->hitCap = 0;
+    f->hitValid = false;
+}
+
+// The query as a pattern; out needs room for twice the query.
+static void find_pattern(const FindBar *f, char *out) {
+    if (f->useRegex) { memcpy(out, f->query, (size_t)f->len + 1); return; }
+    int n = 0;
+    for (int i = 0; i < f->len; i++) {
+        if (strchr("\\.^$|?*+()[]{}", f->query[i])) out[n++] = '\\';
+        out[n++] = f->query[i];
+    }
+    out[n] = '\0';
+}
+
+static bool find_prepare(FindBar *f) {
+    if (!f->stale) return f->compiled;
+    f->stale = false;
+    f->err = NULL;
+    find_free(f);
+    if (f->len == 0) return false;
+
+    char pattern[sizeof(f->query) * 2];
+    find_pattern(f, pattern);
+    f->compiled = regex_compile(&f->re, pattern, !f->matchCase, &f->err);
+    return f->compiled;
+}
+
+// First non-empty match at or after from, wrapping around to the top.
+static bool find_next(FindBar *f, const Buffer *b, int from, ReMatch *m) {
+    if (!find_prepare(f)) return false;
+    for (int pass = 0; pass < 2; pass++) {
+        int pos = pass == 0 ? from : 0;
+        int stop = pass == 0 ? b->len : from;
+        while (pos <= b->len && regex_search(&f->re, b->data, b->len, pos, stop, m, NULL)) {
+            if (pass == 1 && m->a >= from) break;
+            if (m->z > m->a) return true;
+            pos = m->a + 1;
+        }
+    }
+    return false;
+}
+
+// Last non-empty match starting before `before`. Searches a window that
+// doubles until it finds one, so the cost tracks the distance to the match.
+static bool find_last_before(FindBar *f, const Buffer *b, int before, ReMatch *out) {
+    for (long w = 1 << 16; ; w *= 2) {
+        int from = before > w ? before - (int)w : 0;
+        bool any = false;
+        ReMatch m;
+        int pos = from;
+        while (pos < before && regex_search(&f->re, b->data, b->len, pos, before, &m, NULL) && m.a < before) {
+            if (m.z > m.a) { *out = m; any = true; }
+            pos = m.z > m.a ? m.z : m.a + 1;
+        }
+        if (any) return true;
+        if (from == 0) return false;
+    }
+}
+
+static bool find_prev(FindBar *f, const Buffer *b, int before, ReMatch *m) {
+    if (!find_prepare(f)) return false;
+    return find_last_before(f, b, before, m) || find_last_before(f, b, b->len, m);
+}
+
+static int find_cmp(const char *a, const char *b, int n, bool matchCase) {
+    return matchCase ? memcmp(a, b, (size_t)n) : strncasecmp(a, b, (size_t)n);
+}
+
+// Whether two occurrences of q can overlap, i.e. some proper suffix of q is
+// also a prefix. Then a left-to-right scan skips some occurrences.
+static bool find_self_overlaps(const char *q, int n, bool matchCase) {
+    for (int i = 1; i < n; i++)
+        if (find_cmp(q + i, q, n - i, matchCase) == 0) return true;
+    return false;
+}
+
+// A plain query that extends the one the hit set holds only matches where an
+// old hit starts, so the set is filtered in place instead of rescanned. That
+// holds as long as old occurrences could not overlap (or some were skipped).
+static bool find_can_narrow(const FindBar *f, const Buffer *b) {
+    return f->hitValid && f->hitVersion == b->version && !f->useRegex && !f->hitRegex &&
+           f->matchCase == f->hitCase && f->hitLen > 0 && f->len > f->hitLen &&
+           find_cmp(f->query, f->hitQuery, f->hitLen, f->matchCase) == 0 &&
+           !find_self_overlaps(f->hitQuery, f->hitLen, f->matchCase);
+}
+
+static void find_narrow(FindBar *f, const Buffer *b) {
+    int n = 0, lastEnd = 0;
+    for (int i = 0; i < f->hitCount; i++) {
+        int a = f->hits[i].a;
+        if (a < lastEnd || a + f->len > b->len) continue;
+        if (find_cmp(b->data + a, f->query, f->len, f->matchCase) != 0) continue;
+        f->hits[n++] = (ReMatch){ a, a + f->len };
+        lastEnd = a + f->len;
+    }
+    f->hitCount = n;
+    f->scanned = maxi(f->scanned, lastEnd);
+    f->capped = false;
+    f->scanDone = f->scanned >= b->len;
+}
+
+static bool find_hits_push(FindBar *f, ReMatch m) {
+    if (f->hitCount == FIND_MAX_HITS) return false;
+    if (f->hitCount == f->hitCap) {
+        int cap = f->hitCap ? f->hitCap * 2 : 1024;
+        ReMatch *p = (ReMatch*)realloc(f->hits, sizeof(ReMatch) * (size_t)cap);
+        if (!p) return false;
+        f->hits = p;
+        f->hitCap = cap;
+    }
+    f->hits[f->hitCount++] = m;
+    return true;
+}
+
+// Brings the hit set in line with the query and the text, then scans on for
+// up to budget seconds. A query change takes effect on the next call, so a
+// stale scan never runs past the frame it was overtaken in.
+static void find_scan(FindBar *f, const Buffer *b, double budget) {
+    bool same = f->hitValid && f->hitVersion == b->version && f->hitLen == f->len &&
+                f->hitRegex == f->useRegex && f->hitCase == f->matchCase &&
+                memcmp(f->hitQuery, f->query, (size_t)f->len) == 0;
+    if (!same) {
+        bool narrow = find_can_narrow(f, b);
+        memcpy(f->hitQuery, f->query, (size_t)f->len + 1);
+        f->hitLen = f->len;
+        f->hitRegex = f->useRegex;
+        f->hitCase = f->matchCase;
+        f->hitVersion = b->version;
+        f->hitValid = true;
+        if (narrow && find_prepare(f)) find_narrow(f, b);
+        else {
+            f->hitCount = 0;
+            f->scanned = 0;
+            f->capped = false;
+            f->scanDone = !find_prepare(f);
+        }
+    }
+    if (f->scanDone) return;
+
+    double until = GetTime() + budget;
+    do {
+        int stop = b->len - f->scanned > FIND_SCAN_SLICE ? f->scanned + FIND_SCAN_SLICE : b->len;
+        ReMatch m;
+        int resume = f->scanned;
+        if (regex_search(&f->re, b->data, b->len, f->scanned, stop, &m, &resume)) {
+            if (m.z == m.a) f->scanned = m.a + 1;
+            else if (find_hits_push(f, m)) f->scanned = m.z;
+            else { f->capped = true; f->scanDone = true; }
+        } else {
+            f->scanned = resume >= stop ? resume : b->len;
+        }
+        if (f->scanned >= b->len) f->scanDone = true;
+    } while (!f->scanDone && GetTime() < until);
+}
+
+// Index of the first hit ending after pos.
+static int find_hit_after(const FindBar *f, int pos) {
+    int lo = 0, hi = f->hitCount;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (f->hits[mid].z <= pos) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// Where an as-you-type search lands: the first match at or after origin,
+// wrapping to the top. False while the scan has not got that far.
+static bool find_jump_target(FindBar *f, const Buffer *b, ReMatch *m) {
+    int i = find_hit_after(f, f->origin);
+    while (i < f->hitCount && f->hits[i].a < f->origin) i++;
+    if (i < f->hitCount) { *m = f->hits[i]; return true; }
+    if (!f->scanDone) return false;
+    if (f->capped) return find_next(f, b, f->origin, m);
+    if (f->hitCount) { *m = f->hits[0]; return true; }
+    return false;
+}
+
+// Matches overlapping [a, z), for drawing. Text the scan has not reached yet
+// is searched directly, so what is on screen is highlighted right away; the
+// search looks no further back than lineStart nor on past a bounded stretch
+// of lineEnd.
+static int find_hits_in(FindBar *f, const Buffer *b, int a, int z, int lineStart, int lineEnd,
+                        ReMatch *out, int max) {
+    if (!f->hitValid || f->hitVersion != b->version || !f->compiled || f->stale) return 0;
+    int n = 0;
+    if (z <= f->scanned) {
+        for (int i = find_hit_after(f, a); i < f->hitCount && f->hits[i].a < z && n < max; i++) out[n++] = f->hits[i];
+        return n;
+    }
+    int len = f->re.singleLine ? mini(lineEnd, z + 4096) : b->len;
+    int pos = maxi(lineStart, a - (int)sizeof(f->query));
+    ReMatch m;
+    while (n < max && pos < z && regex_search(&f->re, b->data, len, pos, z, &m, NULL) && m.a < z) {
+        if (m.z > a && m.z > m.a) out[n++] = m;
+        pos = m.z > m.a ? m.z : m.a + 1;
+    }
+    return n;
+}
+
+// Highlights the hits on one drawn stretch of text [segA, segZ) whose first
+// byte sits at x0; clipped to [clipL, clipR].
+static void find_hits_draw(FindBar *f, const Buffer *b, int segA, int segZ, int lineStart, int lineEnd,
+                           float x0, float clipL, float clipR, float y, float h, float charW, Color c) {
+    ReMatch hits[64];
+    int n = find_hits_in(f, b, segA, segZ, lineStart, lineEnd, hits, 64);
+    for (int i = 0; i < n; i++) {
+        float x1 = x0 + (maxi(hits[i].a, segA) - segA) * charW;
+        float x2 = x0 + (mini(hits[i].z, segZ) - segA) * charW;
+        if (x1 < clipL) x1 = clipL;
+        if (x2 > clipR) x2 = clipR;
+        if (x2 > x1) DrawRectangle((int)x1, (int)y, (int)(x2 - x1), (int)h, c);
+    }
+}
+
+static FindAction find_update(FindBar *f) {
+    bool alt = IsKeyDown(KEY_LEFT_ALT);
+    bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+    bool onWith = f->replacing && f->focusWith;
+    char *field = onWith ? f->with : f->query;
+    int *len = onWith ? &f->withLen : &f->len;
+
+    int ch = GetCharPressed();
+    while (ch > 0) {
+        if (!alt && ch >= 32 && ch <= 126 && *len < (int)sizeof(f->query) - 1) {
+            field[(*len)++] = (char)ch;
+            field[*len] = '\0';
+            if (!onWith) { f->stale = true; f->notFound = false; f->jumpPending = true; }
+        }
+        ch = GetCharPressed();
+    }
+    if ((IsKeyPressed(KEY_BACKSPACE) || IsKeyPressedRepeat(KEY_BACKSPACE)) && *len > 0) {
+        field[--(*len)] = '\0';
+        if (!onWith) { f->stale = true; f->notFound = false; f->jumpPending = true; }
+    }
+    if (alt && IsKeyPressed(KEY_C)) { f->matchCase = !f->matchCase; f->stale = true; f->jumpPending = true; }
+    if (alt && IsKeyPressed(KEY_R)) { f->useRegex = !f->useRegex; f->stale = true; f->jumpPending = true; }
+    if (f->replacing && IsKeyPressed(KEY_TAB)) f->focusWith = !f->focusWith;
+
+    if (IsKeyPressed(KEY_ESCAPE)) return FIND_CLOSE;
+    if (IsKeyPressed(KEY_ENTER) || IsKeyPressedRepeat(KEY_ENTER) || IsKeyPressed(KEY_KP_ENTER)) {
+        if (onWith) return IsKeyPressed(KEY_ENTER) || IsKeyPressed(KEY_KP_ENTER) ? FIND_REPLACE_ALL : FIND_NONE;
+        return shift ? FIND_PREV : FIND_NEXT;
+    }
+    return FIND_NONE;
+}
+
+// One line of the bar: the tail of a long value, so the caret stays visible,
+// or a placeholder when empty. The caret is drawn only in the focused field.
+static void find_field_draw(Rectangle q, const char *value, int len, const char *placeholder, bool focused,
+                            const char *status, Color statusColor, Font font, float fontSize,
+                            Color text, Color muted, Color accent) {
+    DrawRectangleRec(q, (Color){20,24,31,255});
+    float statusW = status[0] ? MeasureTextEx(font, status, fontSize, 0).x : 0.0f;
+    if (status[0]) draw_text(font, status, q.x + q.width - statusW - 8, q.y + 5, fontSize, statusColor);
+
+    const char *shown = value;
+    while (*shown && MeasureTextEx(font, shown, fontSize, 0).x > q.width - statusW - 24) shown++;
+    if (len) draw_text(font, shown, q.x + 8, q.y + 5, fontSize, text);
+    else draw_text(font, placeholder, q.x + 8, q.y + 5, fontSize, muted);
+    if (!focused) return;
+    float cx = q.x + 8 + (len ? MeasureTextEx(font, shown, fontSize, 0).x : 0.0f);
+    DrawRectangle((int)cx + 1, (int)q.y + 4, 2, 20, accent);
+}
+
+// Where the bar sits over the editor card.
+static Rectangle find_box(const FindBar *f, Rectangle area) {
+    float boxW = mini(480, (int)area.width - 40);
+    return (Rectangle){ area.x + area.width - boxW - 16, area.y + 10, boxW, f->replacing ? 80 : 44 };
+}
+
+// Returns true when the "All" button was clicked.
+static bool find_draw(FindBar *f, Rectangle area, Font font, float fontSize,
+                      Color text, Color muted, Color accent, Color border) {
+    Rectangle box = find_box(f, area);
+    float boxW = box.width;
+    DrawRectangleRounded(box, 0.20f, 10, (Color){28,33,41,255});
+    DrawRectangleRoundedLines(box, 0.20f, 10, border);
+
+    Rectangle bCase = { box.x + boxW - 2*40 - 4, box.y + 8, 36, 28 };
+    Rectangle bRegex = { box.x + boxW - 40 - 4, box.y + 8, 36, 28 };
+    Rectangle q = { box.x + 8, box.y + 8, bCase.x - box.x - 16, 28 };
+    char count[32] = "";
+    if (f->len && f->hitValid) {
+        if (f->scanDone && f->hitCount == 0) snprintf(count, sizeof(count), "No results");
+        else snprintf(count, sizeof(count), "%d%s", f->hitCount, f->capped ? "+" : (f->scanDone ? "" : "…"));
+    }
+    const char *status = f->err ? f->err : (f->notFound ? "No results" : count);
+    find_field_draw(q, f->query, f->len, f->useRegex ? "Find (regex)" : "Find", !(f->replacing && f->focusWith),
+                    status, f->err ? (Color){ 248, 113, 113, 255 } : muted, font, fontSize, text, muted, accent);
+
+    Color b0 = (Color){28,33,41,255}, b1 = (Color){33,39,49,255}, b2 = (Color){40,46,58,255};
+    bool all = false;
+    if (f->replacing) {
+        Rectangle r = { q.x, q.y + 36, q.width, 28 };
+        Rectangle bAll = { bCase.x, r.y, bRegex.x + bRegex.width - bCase.x, 28 };
+        find_field_draw(r, f->with, f->withLen, "Replace", f->focusWith, "", muted, font, fontSize, text, muted, accent);
+        if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
+            Vector2 mp = GetMousePosition();
+            if (CheckCollisionPointRec(mp, q)) f->focusWith = false;
+            if (CheckCollisionPointRec(mp, r)) f->focusWith = true;
+        }
+        all = ui_button(bAll, "All", font, fontSize, b0, b1, b2, f->withLen || f->len ? text : muted);
+    }
+    if (ui_button(bCase, "Aa", font, fontSize, f->matchCase ? b2 : b0, b1, b2, f->matchCase ? accent : muted)) {
+        f->matchCase = !f->matchCase;
+        f->stale = true;
+        f->jumpPending = true;
+    }
+    if (ui_button(bRegex, ".*", font, fontSize, f->useRegex ? b2 : b0, b1, b2, f->useRegex ? accent : muted)) {
+        f->useRegex = !f->useRegex;
+        f->stale = true;
+        f->jumpPending = true;
+    }
+    return all;
+}
+
+// --- Replace all ---
+// Replace-all never edits the buffer in place. A worker streams the text into
+// a fresh array, copying the gaps and writing the replacement for each match,
+// builds the new line index alongside, and the buffer then takes both whole
+// as one undo step. The worker compiles its own copy of the pattern (a DFA's
+// state cache is not shared between threads) and only reads the buffer, which
+// the editor leaves alone until the job is finished and joined.
+enum { REPLACE_IDLE, REPLACE_RUNNING, REPLACE_DONE, REPLACE_FAILED, REPLACE_CANCELLED };
+
+// Bytes scanned between progress updates and cancel checks.
+#define REPLACE_CHUNK (4 << 20)
+
+typedef struct {
+    pthread_t thread;
+    Regex re;
+    const char *src;
+    int len;
+    char with[256];
+    int withLen;
+    char *out;
+    int outLen, outCap;
+    LineIndex lines;
+    int count;
+    int cursorIn, cursorOut;
+    atomic_int progress;
+    atomic_bool cancel;
+    atomic_int state;
+} ReplaceJob;
+
+static bool replace_append(ReplaceJob *j, const char *s, int n) {
+    if (n == 0) return true;
+    if (j->outLen > INT_MAX - 1 - n) return false;
+    if (j->outLen + n + 1 > j->outCap) {
+        long cap = j->outCap;
+        while (cap < (long)j->outLen + n + 1) cap *= 2;
+        if (cap > INT_MAX) cap = INT_MAX;
+        char *p = (char*)realloc(j->out, (size_t)cap);
+        if (!p) return false;
+        j->out = p;
+        j->outCap = (int)cap;
+    }
+    memcpy(j->out + j->outLen, s, (size_t)n);
+    j->outLen += n;
+    return true;
+}
+
+static void *replace_main(void *arg) {
+    ReplaceJob *j = (ReplaceJob*)arg;
+    j->outCap = j->len + j->len / 8 + 64;
+    j->out = (char*)malloc((size_t)j->outCap);
+    bool ok = j->out != NULL;
+    int pos = 0, copied = 0;
+    j->cursorOut = -1;
+
+    // Like find, only non-empty matches are replaced.
+    while (ok && pos <= j->len) {
+        if (atomic_load(&j->cancel)) break;
+        int stop = j->len - pos > REPLACE_CHUNK ? pos + REPLACE_CHUNK : j->len;
+        ReMatch m;
+        int resume = pos;
+        if (!regex_search(&j->re, j->src, j->len, pos, stop, &m, &resume)) {
+            if (stop == j->len || resume < stop) break;
+            pos = resume;
+            atomic_store(&j->progress, pos);
+            continue;
+        }
+        if (m.z == m.a) { pos = m.a + 1; continue; }
+
+        // The cursor keeps its place in the text around it, or lands at the
+        // start of a match it was inside.
+        if (j->cursorOut < 0 && m.a >= j->cursorIn) j->cursorOut = j->cursorIn + (j->outLen - copied);
+        else if (j->cursorOut < 0 && j->cursorIn < m.z) j->cursorOut = j->outLen + (m.a - copied);
+
+        ok = replace_append(j, j->src + copied, m.a - copied) && replace_append(j, j->with, j->withLen);
+        copied = pos = m.z;
+        j->count++;
+        atomic_store(&j->progress, pos);
+    }
+
+    if (ok && atomic_load(&j->cancel)) { atomic_store(&j->state, REPLACE_CANCELLED); return NULL; }
+    ok = ok && replace_append(j, j->src + copied, j->len - copied);
+    if (ok) {
+        j->out[j->outLen] = '\0';
+        if (j->cursorOut < 0) j->cursorOut = j->cursorIn + (j->outLen - j->len);
+        li_init(&j->lines);
+        li_rebuild(&j->lines, j->out, j->outLen);
+        ok = j->lines.starts != NULL;
+    }
+    atomic_store(&j->state, ok ? REPLACE_DONE : REPLACE_FAILED);
+    return NULL;
+}
+
+static bool replace_running(ReplaceJob *j) { return atomic_load(&j->state) != REPLACE_IDLE; }
+
+// Starts replacing every match of the find bar's query in b. The buffer must
+// not change until replace_poll reports the job finished.
+static bool replace_start(ReplaceJob *j, FindBar *f, const Buffer *b) {
+    if (replace_running(j) || f->len == 0) return false;
+    char pattern[sizeof(f->query) * 2];
+    find_pattern(f, pattern);
+    if (!regex_compile(&j->re, pattern, !f->matchCase, &f->err)) return false;
+    j->src = b->data;
+    j->len = b->len;
+    memcpy(j->with, f->with, (size_t)f->withLen);
+    j->withLen = f->withLen;
+    j->out = NULL;
+    j->outLen = j->outCap = 0;
+    j->lines = (LineIndex){0};
+    j->count = 0;
+    j->cursorIn = b->cursor;
+    atomic_store(&j->progress, 0);
+    atomic_store(&j->cancel, false);
+    atomic_store(&j->state, REPLACE_RUNNING);
+    if (pthread_create(&j->thread, NULL, replace_main, j) != 0) {
+        atomic_store(&j->state, REPLACE_IDLE);
+        regex_free(&j->re);
+        return false;
+    }
+    return true;
+}
+
+// Percent of the text scanned so far.
+static int replace_percent(ReplaceJob *j) {
+    return j->len ? (int)((long)atomic_load(&j->progress) * 100 / j->len) : 0;
+}
+
+// Once the worker is done, joins it and returns how it ended; REPLACE_RUNNING
+// until then and REPLACE_IDLE when no job is out. On REPLACE_DONE the result
+// is in out/outLen/lines and the caller takes ownership.
+static int replace_poll(ReplaceJob *j) {
+    int st = atomic_load(&j->state);
+    if (st == REPLACE_IDLE || st == REPLACE_RUNNING) return st;
+    pthread_join(j->thread, NULL);
+    regex_free(&j->re);
+    if (st != REPLACE_DONE) { free(j->out); li_free(&j->lines); }
+    atomic_store(&j->state, REPLACE_IDLE);
+    return st;
+}
+
+// Stops a running job and waits for the worker, dropping its output.
+static void replace_cancel(ReplaceJob *j) {
+    if (!replace_running(j)) return;
+    atomic_store(&j->cancel, true);
+    pthread_join(j->thread, NULL);
+    regex_free(&j->re);
+    free(j->out);
+    li_free(&j->lines);
+    atomic_store(&j->state, REPLACE_IDLE);
+}
+
+// --- Startup report ---
+// --startup-report prints how long each launch phase took, measured on the
+// monotonic clock. A mark charges the time since the previous mark to a phase.
+#define STARTUP_MAX_PHASES 12
+
+typedef struct {
+    double t0, last;
+    int count;
+    const char *name[STARTUP_MAX_PHASES];
+    double ms[STARTUP_MAX_PHASES];
+} StartupClock;
+
+static StartupClock startup;
+
+static double mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1.0e6;
+}
 
-    return hot && IsMouseButtonReleased(MOUSE_LEFT_BUTTON);
+static void startup_begin(void) { startup.t0 = startup.last = mono_ms(); startup.count = 0; }
+
+static void startup_mark(const char *phase) {
+    double now = mono_ms();
+    int i = 0;
+    while (i < startup.count && strcmp(startup.name[i], phase) != 0) i++;
+    if (i == startup.count) {
+        if (i == STARTUP_MAX_PHASES) { startup.last = now; return; }
+        startup.name[i] = phase;
+        startup.ms[i] = 0.0;
+        startup.count++;
+    }
+    startup.ms[i] += now - startup.last;
+    startup.last = now;
 }
 
-static bool menu_item_lr(Rectangle r, const char *left, const char *right,
-                         Font font, float fontSize, Color fg) {
-    Vector2 m = GetMousePosition();
-    bool hot = CheckCollisionPointRec(m, r);
-    Color bg = hot ? (Color){33,39,49,255} : (Color){28,33,41,255};
-    DrawRectangleRec(r, bg);
+static void startup_report(void) {
+    fprintf(stderr, "pen startup (ms):\n");
+    for (int i = 0; i < startup.count; i++) fprintf(stderr, "  %-16s %8.2f\n", startup.name[i], startup.ms[i]);
+    fprintf(stderr, "  %-16s %8.2f\n", "total", startup.last - startup.t0);
+}
 
-    draw_text(font, left, r.x + 10, r.y + (r.height - fontSize)/2.0f - 1, fontSize, fg);
+// Linked in from src/assets.S.
+extern const unsigned char pen_font_mono[], pen_font_ui[], pen_icon_png[];
+extern const int pen_font_mono_size, pen_font_ui_size, pen_icon_png_size;
 
-    if (right && right[0]) {
-        Vector2 tw = MeasureTextEx(font, right, fontSize, 0);
-        draw_text(font, right, r.x + r.width - 10 - tw.x, r.y + (r.height - fontSize)/2.0f - 1, fontSize, fg);
-    }
-    return hot && IsMouseButtonReleased(MOUSE_LEFT_BUTTON);
-}
+// Assets are embedded; PEN_ASSET_DIR only overrides them for development.
+static const char* find_asset_override(const char *rel) {
+    static char path[1024];
 
-typedef enum { MENU_NONE, MENU_FILE, MENU_EDIT } Menu;
+    const char *dir = getenv("PEN_ASSET_DIR");
+    if (!dir || !dir[0]) return NULL;
 
-static void restore_cursor_now(void) {
-    EnableCursor();
-    ShowCursor();
-    SetMouseCursor(MOUSE_CURSOR_DEFAULT);
+    snprintf(path, sizeof(path), "%s/%s", dir, rel);
+    return FileExists(path) ? path : NULL;
 }
 
-// --- Toast helper ---
-typedef struct {
-    char msg[128];
-    double until;
-} Toast;
+// --- Font atlas cache ---
+// Baked atlases live in $XDG_CACHE_HOME/pen/, keyed by a hash of the TTF bytes,
+// the pixel size and the codepoint set. A warm start maps the file and uploads
+// the atlas as-is instead of parsing and rasterizing the font.
+#define FONT_CACHE_MAGIC   0x4c544146504e4550ull   /* "PENFATL" */
+#define FONT_CACHE_VERSION 1
+#define FONT_FIRST_CP      32
+#define FONT_GLYPHS        95
+#define FONT_PADDING       4
 
-static void toast_set(Toast *t, const char *msg, double seconds) {
-    strncpy(t->msg, msg, sizeof(t->msg) - 1);
-    t->msg[sizeof(t->msg) - 1] = '\0';
-    t->until = GetTime() + seconds;
+typedef struct {
+    uint64_t magic;
+    uint64_t key;
+    int32_t version;
+    int32_t baseSize, glyphCount, glyphPadding;
+    int32_t width, height, format;
+} FontCacheHeader;
+
+typedef struct { int32_t value, offsetX, offsetY, advanceX; } FontCacheGlyph;
+
+static uint64_t fnv1a(uint64_t h, const void *p, size_t n) {
+    const unsigned char *s = (const unsigned char*)p;
+    for (size_t i = 0; i < n; i++) { h ^= s[i]; h *= 0x100000001b3ull; }
+    return h;
 }
 
-static bool do_open(Buffer *buf, Selection *sel, int *scrollRow, char *pathOut, int pathOutSz, bool *hasPath) {
-    const char *path = tinyfd_openFileDialog("Open text file", "", 0, NULL, NULL, 0);
-    restore_cursor_now();
-    if (!path || !path[0]) return false;
-
-    bool ok = load_from_path(path, buf, sel, scrollRow);
-    if (ok) {
-        strncpy(pathOut, path, (size_t)pathOutSz - 1);
-        pathOut[pathOutSz - 1] = '\0';
-        *hasPath = true;
+static int atlas_bytes_per_pixel(int format) {
+    switch (format) {
+        case PIXELFORMAT_UNCOMPRESSED_GRAYSCALE:  return 1;
+        case PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA: return 2;
+        case PIXELFORMAT_UNCOMPRESSED_R8G8B8A8:   return 4;
+        default: return 0;
     }
-    return ok;
 }
 
-static bool do_save_as(const Buffer *buf, char *pathOut, int pathOutSz, bool *hasPath) {
-    const char *suggest = (*hasPath && pathOut[0]) ? pathOut : "untitled.txt";
-    const char *path = tinyfd_saveFileDialog("Save As", suggest, 0, NULL, NULL);
-    restore_cursor_now();
-    if (!path || !path[0]) return false;
+static bool font_cache_path(char *out, size_t outSz, uint64_t key) {
+    char dir[768];
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (xdg && xdg[0]) snprintf(dir, sizeof(dir), "%s", xdg);
+    else if (home && home[0]) snprintf(dir, sizeof(dir), "%s/.cache", home);
+    else return false;
+
+    mkdir(dir, 0755);
+    strncat(dir, "/pen", sizeof(dir) - strlen(dir) - 1);
+    mkdir(dir, 0755);
+    snprintf(out, outSz, "%s/font-%016llx.atlas", dir, (unsigned long long)key);
+    return true;
+}
 
-    bool ok = save_to_path(path, buf);
+static bool font_cache_read(const char *path, uint64_t key, Font *out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FontCacheHeader)) { close(fd); return false; }
+    size_t size = (size_t)st.st_size;
+    const unsigned char *map = (const unsigned char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    FontCacheHeader h;
+    memcpy(&h, map, sizeof(h));
+    int bpp = atlas_bytes_per_pixel(h.format);
+    size_t recsOff   = sizeof(h);
+    size_t glyphsOff = recsOff + sizeof(Rectangle) * (size_t)h.glyphCount;
+    size_t pixOff    = glyphsOff + sizeof(FontCacheGlyph) * (size_t)h.glyphCount;
+    bool ok = h.magic == FONT_CACHE_MAGIC && h.key == key && h.version == FONT_CACHE_VERSION &&
+              h.glyphCount > 0 && h.glyphCount <= 4096 && h.width > 0 && h.height > 0 && bpp > 0 &&
+              size == pixOff + (size_t)h.width * (size_t)h.height * (size_t)bpp;
+
+    Font f = {0};
     if (ok) {
-        strncpy(pathOut, path, (size_t)pathOutSz - 1);
-        pathOut[pathOutSz - 1] = '\0';
-        *hasPath = true;
+        f.recs = (Rectangle*)malloc(sizeof(Rectangle) * (size_t)h.glyphCount);
+        f.glyphs = (GlyphInfo*)calloc((size_t)h.glyphCount, sizeof(GlyphInfo));
+        ok = f.recs && f.glyphs;
     }
-    return ok;
-}
+    if (ok) {
+        f.baseSize = h.baseSize;
+        f.glyphCount = h.glyphCount;
+        f.glyphPadding = h.glyphPadding;
+        memcpy(f.recs, map + recsOff, sizeof(Rectangle) * (size_t)h.glyphCount);
+        for (int i = 0; i < h.glyphCount; i++) {
+            FontCacheGlyph g;
+            memcpy(&g, map + glyphsOff + sizeof(g) * (size_t)i, sizeof(g));
+            f.glyphs[i].value = g.value;
+            f.glyphs[i].offsetX = g.offsetX;
+            f.glyphs[i].offsetY = g.offsetY;
+            f.glyphs[i].advanceX = g.advanceX;
+        }
+        Image atlas = { .data = (void*)(map + pixOff), .width = h.width, .height = h.height,
+                        .mipmaps = 1, .format = h.format };
+        f.texture = LoadTextureFromImage(atlas);
+        ok = f.texture.id != 0;
+    }
+    munmap((void*)map, size);
 
-static bool do_save(const Buffer *buf, char *pathOut, int pathOutSz, bool *hasPath) {
-    if (*hasPath && pathOut[0]) return save_to_path(pathOut, buf);
-    return do_save_as(buf, pathOut, pathOutSz, hasPath);
+    if (!ok) { free(f.recs); free(f.glyphs); return false; }
+    *out = f;
+    return true;
 }
 
-static const char* find_asset(const char *rel) {
-    static char path[1024];
-
-    const char *appdir = getenv("APPDIR");
-    if (appdir && appdir[0]) {
-        snprintf(path, sizeof(path), "%s/usr/share/pen/assets/%s", appdir, rel);
-        if (FileExists(path)) return path;
+static void font_cache_write(const char *path, uint64_t key, const Font *f, Image atlas) {
+    int bpp = atlas_bytes_per_pixel(atlas.format);
+    if (bpp == 0) return;
+
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    FILE *out = fopen(tmp, "wb");
+    if (!out) return;
+
+    FontCacheHeader h = { FONT_CACHE_MAGIC, key, FONT_CACHE_VERSION, f->baseSize, f->glyphCount,
+                          f->glyphPadding, atlas.width, atlas.height, atlas.format };
+    bool ok = fwrite(&h, sizeof(h), 1, out) == 1 &&
+              fwrite(f->recs, sizeof(Rectangle), (size_t)f->glyphCount, out) == (size_t)f->glyphCount;
+    for (int i = 0; ok && i < f->glyphCount; i++) {
+        FontCacheGlyph g = { f->glyphs[i].value, f->glyphs[i].offsetX, f->glyphs[i].offsetY, f->glyphs[i].advanceX };
+        ok = fwrite(&g, sizeof(g), 1, out) == 1;
     }
+    size_t pix = (size_t)atlas.width * (size_t)atlas.height * (size_t)bpp;
+    ok = ok && fwrite(atlas.data, 1, pix, out) == pix;
+    ok = (fclose(out) == 0) && ok;
 
-    snprintf(path, sizeof(path), "/usr/share/pen/assets/%s", rel);
-    if (FileExists(path)) return path;
+    if (ok) rename(tmp, path);
+    else remove(tmp);
+}
 
-    snprintf(path, sizeof(path), "/usr/local/share/pen/assets/%s", rel);
-    if (FileExists(path)) return path;
+// Same steps LoadFontFromMemory takes, but keeps the atlas image long enough
+// to write it to the cache.
+static Font font_bake(const unsigned char *data, int size, int px, const char *cachePath, uint64_t key) {
+    Font f = {0};
+    f.baseSize = px;
+    f.glyphCount = FONT_GLYPHS;
+    f.glyphPadding = FONT_PADDING;
+    f.glyphs = LoadFontData(data, size, px, NULL, FONT_GLYPHS, FONT_DEFAULT);
+    if (!f.glyphs) return (Font){0};
+
+    Image atlas = GenImageFontAtlas(f.glyphs, &f.recs, f.glyphCount, px, f.glyphPadding, 0);
+    f.texture = LoadTextureFromImage(atlas);
+    if (cachePath && f.texture.id) font_cache_write(cachePath, key, &f, atlas);
+    UnloadImage(atlas);
+    return f;
+}
 
-    snprintf(path, sizeof(path), "assets/%s", rel);
-    if (FileExists(path)) return path;
+static Font font_load_cached(const unsigned char *data, int size, int px) {
+    uint64_t key = 0xcbf29ce484222325ull;
+    int32_t params[3] = { px, FONT_FIRST_CP, FONT_GLYPHS };
+    key = fnv1a(key, data, (size_t)size);
+    key = fnv1a(key, params, sizeof(params));
+
+    char path[1024];
+    bool havePath = font_cache_path(path, sizeof(path), key);
+    Font f;
+    if (havePath && font_cache_read(path, key, &f)) return f;
+    return font_bake(data, size, px, havePath ? path : NULL, key);
+}
 
-    snprintf(path, sizeof(path), "../assets/%s", rel);
-    if (FileExists(path)) return path;
+static Font load_font_asset(const char *rel, const unsigned char *data, int size, int px) {
+    const char *path = find_asset_override(rel);
+    startup_mark("asset lookup");
+    unsigned char *fileData = NULL;
+    if (path) {
+        int n = 0;
+        fileData = LoadFileData(path, &n);
+        if (fileData) { data = fileData; size = n; }
+    }
+    Font f = font_load_cached(data, size, px);
+    if (fileData) UnloadFileData(fileData);
+    return f;
+}
 
-    snprintf(path, sizeof(path), "assets/%s", rel);
-    return path;
+static void set_window_icon(void) {
+    const char *path = find_asset_override("icons/pen-64.png");
+    startup_mark("asset lookup");
+    Image icon = path ? LoadImage(path) : LoadImageFromMemory(".png", pen_icon_png, pen_icon_png_size);
+    if (icon.data) { SetWindowIcon(icon); UnloadImage(icon); }
 }
 
 
-int main(void) {
-    SetConfigFlags(FLAG_WINDOW_RESIZABLE | FLAG_VSYNC_HINT);
+int main(int argc, char **argv) {
+    startup_begin();
+
+    // --startup-report, plus --hidden and --quit-after-first-frame for the
+    // launch benchmark (make bench-startup).
+    bool startupReport = false, hidden = false, quitAfterFirstFrame = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--startup-report") == 0) startupReport = true;
+        else if (strcmp(argv[i], "--hidden") == 0) hidden = true;
+        else if (strcmp(argv[i], "--quit-after-first-frame") == 0) quitAfterFirstFrame = true;
+    }
+
+    SetConfigFlags(FLAG_WINDOW_RESIZABLE | FLAG_VSYNC_HINT | (hidden ? FLAG_WINDOW_HIDDEN : 0));
     InitWindow(1200, 640, "Pen");
+    startup_mark("InitWindow");
+    dialog_probe_start();
+    set_window_icon();
+    startup_mark("window icon");
     SetTargetFPS(60);
+    SetExitKey(KEY_NULL);
+    char_class_init();
 
-    Buffer buf; buf_init(&buf);
+    // Filled in from the active tab below.
+    Buffer buf = {0};
     Selection sel; sel_set_single(&sel, 0);
 
     int textPx = 22;
-    Font editorFont = LoadFontEx(find_asset("fonts/JetBrainsMonoNL-Regular.ttf"), textPx, NULL, 0);
+    Font editorFont = load_font_asset("fonts/JetBrainsMonoNL-Regular.ttf", pen_font_mono, pen_font_mono_size, textPx);
     if (editorFont.texture.id == 0) editorFont = GetFontDefault();
+    startup_mark("editor font");
 
     float uiSize = 16.0f;
-    Font uiFont     = LoadFontEx(find_asset("fonts/Inter-Regular.ttf"), (int)uiSize, NULL, 0);
+    Font uiFont     = load_font_asset("fonts/Inter-Regular.ttf", pen_font_ui, pen_font_ui_size, (int)uiSize);
     if (uiFont.texture.id == 0) uiFont = editorFont;
+    startup_mark("ui font");
 
     const float fontSize = (float)textPx;
     const float lineGap  = 8.0f;
@@ -374,34 +5005,94 @@ int main(void) {
     float charW = MeasureTextEx(editorFont, "M", fontSize, 0).x;
     if (charW < 1.0f) charW = 12.0f;
 
-    int scrollRow = 0;
+    Scroller scroll = {0};
     int desiredCol = 0;
     bool dragging = false;
 
+    Carets carets = {0};
+    Block block = {0};
+    bool columnDrag = false;
+
+    // No-wrap mode scrolls horizontally in pixels; only the columns inside the
+    // viewport are ever copied, measured or drawn.
+    bool wrapLines = true;
+    float scrollX = 0.0f;
+    int prevCursor = 0;
+
+    bool showGutter = true;
+    Gutter gutter; gutter_init(&gutter);
+    GlyphBatch glyphs; glyphs_init(&glyphs, editorFont, fontSize);
+
+    bool showMinimap = true;
+    bool mmDragging = false;
+    Minimap minimap = {0};
+
+    bool showSyntax = true;
+    Syntax syntax = {0};
+
     char currentPath[512] = "";
     bool hasPath = false;
+    // The file as it was when the text last matched it, and a watch for when
+    // it stops doing so.
+    FileStamp disk = {0};
+    FileWatch watch; watch_init(&watch);
+
+    bool builtinPicker = false;
+    FilePicker picker = {0};
+    DirCache dirCache; dircache_init(&dirCache);
+    AsyncDialog fileDialog = {0};
 
     // Dirty + Toast
     bool dirty = false;
     Toast toast = { .msg = "", .until = 0 };
 
-    // Backspace repeat
-    double bsNext = 0.0;
-    bool bsHeldPrev = false;
-    const double BS_INITIAL_DELAY = 0.32;
-    const double BS_REPEAT_RATE   = 0.045;
+    GotoBar gotoBar = {0};
+    FindBar findBar = {0};
+    ReplaceJob replaceJob = {0};
+
+    // Open documents; the active one is edited in the locals above.
+    DocLive live = { &buf, &sel, &scroll, &scrollX, &desiredCol, &carets, &block, &syntax,
+                     currentPath, (int)sizeof(currentPath), &hasPath, &dirty, &disk };
+    Tabs tabs = {0};
+    tabs_set_budget(&tabs);
+    int restored = session_load(&tabs);
+    if (tabs.count == 0) tabs_push(&tabs);
+    tabs.active = maxi(restored, 0);
+    doc_load_note(&toast, doc_unpark(&tabs.docs[tabs.active], &live, &tabs.swap));
+    prevCursor = buf.cursor;
+    // Heap of the active document, recounted only when it changes.
+    size_t liveBytes = doc_bytes(&buf, &syntax, &carets);
+    unsigned liveBytesVersion = buf.version;
+    startup_mark("session");
+    int closeArmed = -1;
+    double closeArmedUntil = 0.0;
+
+    KeyRepeat keyRepeat;
+    key_repeat_init(&keyRepeat);
 
     Menu menu = MENU_NONE;
     bool quitRequested = false;
+    bool quitAsked = false;         // Esc, Ctrl+Q or File > Quit this frame
+    double quitArmedUntil = 0.0;
 
     bool wasFocused = IsWindowFocused();
+    bool firstFrame = true;
 
     while (!WindowShouldClose() && !quitRequested) {
+        // Tab changes asked for during the frame are applied at its end.
+        int tabTo = -1, tabClose = -1;
+        bool tabNew = false, tabChanged = false;
+
         bool focused = IsWindowFocused();
         if (focused && !wasFocused) restore_cursor_now();
         wasFocused = focused;
 
-        if (IsKeyPressed(KEY_ESCAPE)) quitRequested = true;
+        if (IsKeyPressed(KEY_ESCAPE) && !picker.open && !gotoBar.open && !findBar.open && !replace_running(&replaceJob)) {
+            // With several cursors or a block, Esc first drops back to one cursor.
+            if (carets.count > 1) { carets_clear(&carets); sel_set_single(&sel, buf.cursor); }
+            else if (block.active) block.active = false;
+            else quitAsked = true;
+        }
 
         int w = GetScreenWidth();
         int h = GetScreenHeight();
@@ -413,6 +5104,7 @@ int main(void) {
         Color accent = (Color){ 96, 165, 250, 255 };
         Color border = (Color){ 35, 42, 54, 255 };
         Color selBg  = (Color){ 96, 165, 250, 80 };
+        Color hitBg  = (Color){ 250, 204, 21, 60 };
 
         const int topBarH = 44;
 
@@ -421,10 +5113,19 @@ int main(void) {
         int cardW = w - 80;
         int cardH = h - cardY - 60;
         if (cardH < 120) cardH = 120;
+        if (showMinimap) cardW -= MINIMAP_W + 24;
+
+        Rectangle mmArea = { (float)cardX + cardW + 12, (float)cardY, MINIMAP_W + 12, (float)cardH };
+        Rectangle mmTex  = { mmArea.x + 6, mmArea.y + 8, MINIMAP_W, mmArea.height - 16 };
 
         int pad = 22;
         Rectangle textArea = { (float)cardX + pad, (float)cardY + pad, (float)cardW - pad*2, (float)cardH - pad*2 };
 
+        float gutterW = showGutter ? gutter_width(&gutter, total_rows(&buf), charW) : 0.0f;
+        float gutterRight = textArea.x + gutterW - charW;
+        textArea.x += gutterW;
+        textArea.width -= gutterW;
+
         int visibleRows = (int)(textArea.height / lineH);
         if (visibleRows < 1) visibleRows = 1;
 
@@ -432,182 +5133,531 @@ int main(void) {
         int maxScroll = rows - visibleRows;
         if (maxScroll < 0) maxScroll = 0;
 
+        Rectangle sbTrack = scrollbar_track((Rectangle){ (float)cardX, (float)cardY, (float)cardW, (float)cardH });
+
         bool ctrl  = IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL);
         bool shiftKey = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+        bool altKey = IsKeyDown(KEY_LEFT_ALT);
 
         bool cursorOn = ((int)(GetTime() * 2.0) % 2) == 0;
 
         Vector2 mouse = GetMousePosition();
         bool mouseInText = CheckCollisionPointRec(mouse, textArea);
+        if (watch.prompt && CheckCollisionPointRec(mouse, watch_box((Rectangle){ (float)cardX, (float)cardY, (float)cardW, (float)cardH })))
+            mouseInText = false;
 
-        if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && mouseInText) {
-            dragging = true;
-            int idx = index_from_mouse(&buf, textArea, scrollRow, lineH, charW, mouse);
+        int curRow = 0, curCol = 0;
+        FindAction findAction = FIND_NONE;
+        cursor_row_col(&buf, &curRow, &curCol);
 
-            if (!shiftKey) { buf.cursor = idx; sel_set_single(&sel, idx); }
-            else {
-                if (!sel.active) { sel.active = true; sel.anchor = buf.cursor; sel.caret = buf.cursor; }
-                buf.cursor = idx; sel.caret = buf.cursor;
+        // The built-in file picker is modal: it takes the keyboard and the
+        // editor ignores input until it closes.
+        if (picker.open) { picker_update(&picker, &dirCache); key_repeat_reset(&keyRepeat); }
+        else if (replace_running(&replaceJob)) {
+            // The worker is reading the text: nothing may edit it until the
+            // job finishes. Esc gives up and leaves the text as it was.
+            while (GetCharPressed() > 0) {}
+            if (IsKeyPressed(KEY_ESCAPE)) {
+                replace_cancel(&replaceJob);
+                toast_set(&toast, "Replace cancelled", 1.2);
             }
-            menu = MENU_NONE;
+            float wheel = GetMouseWheelMove();
+            if (wheel != 0.0f) scroll.vel -= wheel * SCROLL_IMPULSE;
+            key_repeat_reset(&keyRepeat);
         }
-        if (dragging && IsMouseButtonDown(MOUSE_LEFT_BUTTON) && mouseInText) {
-            int idx = index_from_mouse(&buf, textArea, scrollRow, lineH, charW, mouse);
-            if (!sel.active) { sel.active = true; sel.anchor = buf.cursor; sel.caret = buf.cursor; }
-            buf.cursor = idx; sel.caret = buf.cursor;
+        else if (gotoBar.open) {
+            int line = 0;
+            GotoResult gr = goto_update(&gotoBar, &line);
+            if (gr != GOTO_NONE) gotoBar.open = false;
+            if (gr == GOTO_JUMP) {
+                int row = clampi(line - 1, 0, total_rows(&buf) - 1);
+                buf.cursor = line_start_index(&buf, row);
+                sel_set_single(&sel, buf.cursor);
+                scroll_to(&scroll, (float)(row - visibleRows / 2), maxScroll);
+                cursor_row_col(&buf, &curRow, &curCol);
+                desiredCol = curCol;
+            }
+            key_repeat_reset(&keyRepeat);
         }
-        if (IsMouseButtonReleased(MOUSE_LEFT_BUTTON)) dragging = false;
-
-        float wheel = GetMouseWheelMove();
-        if (wheel != 0.0f) {
-            scrollRow -= (int)wheel;
-            scrollRow = clampi(scrollRow, 0, maxScroll);
+        else if (findBar.open) {
+            FindAction act = find_update(&findBar);
+            if (act == FIND_CLOSE) { findBar.open = false; find_hits_free(&findBar); }
+            else if (act != FIND_NONE) findAction = act;
+
+            // The wheel still scrolls, and a click in the text goes back to editing.
+            float wheel = GetMouseWheelMove();
+            if (wheel != 0.0f) scroll.vel -= wheel * SCROLL_IMPULSE;
+            Rectangle findRect = find_box(&findBar, (Rectangle){ (float)cardX, (float)cardY, (float)cardW, (float)cardH });
+            if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && mouseInText && !CheckCollisionPointRec(mouse, findRect)) {
+                findBar.open = false;
+                find_hits_free(&findBar);
+            }
+            key_repeat_reset(&keyRepeat);
         }
+        else {
+            if (scrollbar_input(&scroll, sbTrack, visibleRows, rows, mouse)) menu = MENU_NONE;
+
+            if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && mouseInText) {
+                int idx = index_from_mouse(&buf, textArea, scroll.pos, scrollX, lineH, charW, mouse);
+
+                block.active = false;
+                if (ctrl && !shiftKey) {
+                    carets_seed(&carets, &sel, buf.cursor, &buf);
+                    carets_add(&carets, (Selection){ false, idx, idx });
+                    carets_sync(&carets, &sel, &buf);
+                } else if (altKey) {
+                    int row, col;
+                    row_col_from_mouse(&buf, textArea, scroll.pos, scrollX, lineH, charW, mouse, &row, &col);
+                    columnDrag = true;
+                    carets_clear(&carets);
+                    block_set(&block, &buf, true, row, col);
+                    buf.cursor = block_cursor(&block, &buf);
+                    sel_set_single(&sel, buf.cursor);
+                } else {
+                    dragging = true;
+                    carets_clear(&carets);
+                    if (!shiftKey) { buf.cursor = idx; sel_set_single(&sel, idx); }
+                    else {
+                        if (!sel.active) { sel.active = true; sel.anchor = buf.cursor; sel.caret = buf.cursor; }
+                        buf.cursor = idx; sel.caret = buf.cursor;
+                    }
+                }
+                menu = MENU_NONE;
+            }
+            if (columnDrag && IsMouseButtonDown(MOUSE_LEFT_BUTTON)) {
+                int row, col;
+                row_col_from_mouse(&buf, textArea, scroll.pos, scrollX, lineH, charW, mouse, &row, &col);
+                block_set(&block, &buf, false, row, col);
+                buf.cursor = block_cursor(&block, &buf);
+                sel_set_single(&sel, buf.cursor);
+            }
+            if (IsMouseButtonReleased(MOUSE_LEFT_BUTTON)) columnDrag = false;
+            if (dragging && IsMouseButtonDown(MOUSE_LEFT_BUTTON) && mouseInText) {
+                int idx = index_from_mouse(&buf, textArea, scroll.pos, scrollX, lineH, charW, mouse);
+                if (!sel.active) { sel.active = true; sel.anchor = buf.cursor; sel.caret = buf.cursor; }
+                buf.cursor = idx; sel.caret = buf.cursor;
+            }
+            if (IsMouseButtonReleased(MOUSE_LEFT_BUTTON)) dragging = false;
 
-        // --- File shortcuts (and dirty/toast) ---
-        if (ctrl && IsKeyPressed(KEY_O)) {
-            if (do_open(&buf, &sel, &scrollRow, currentPath, (int)sizeof(currentPath), &hasPath)) {
-                dirty = false;
-                toast_set(&toast, "Opened", 1.0);
+            if (showMinimap && IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && CheckCollisionPointRec(mouse, mmTex)) {
+                mmDragging = true;
+                menu = MENU_NONE;
+            }
+            if (mmDragging && IsMouseButtonDown(MOUSE_LEFT_BUTTON) && minimap.linesPerPx > 0) {
+                int target = clampi((int)(mouse.y - mmTex.y) * minimap.linesPerPx, 0, rows - 1);
+                buf.cursor = line_start_index(&buf, target);
+                sel_set_single(&sel, buf.cursor);
+                scroll_to(&scroll, (float)(target - visibleRows / 2), maxScroll);
+            }
+            if (IsMouseButtonReleased(MOUSE_LEFT_BUTTON)) mmDragging = false;
+
+            float wheel = GetMouseWheelMove();
+            float wheelX = GetMouseWheelMoveV().x;
+            if (!wrapLines && shiftKey && wheel != 0.0f) { wheelX = wheel; wheel = 0.0f; }
+            if (wheel != 0.0f && !scroll.dragging) scroll.vel -= wheel * SCROLL_IMPULSE;
+            if (!wrapLines && wheelX != 0.0f) {
+                scrollX -= wheelX * charW * 4.0f;
+                if (scrollX < 0.0f) scrollX = 0.0f;
             }
-        }
 
-        if (ctrl && IsKeyPressed(KEY_S) && !shiftKey) {
-            if (do_save(&buf, currentPath, (int)sizeof(currentPath), &hasPath)) {
-                dirty = false;
-                toast_set(&toast, "Saved", 1.2);
+            if (altKey && IsKeyPressed(KEY_Z)) {
+                wrapLines = !wrapLines;
+                scrollX = 0.0f;
+                toast_set(&toast, wrapLines ? "Word wrap on" : "Word wrap off", 1.0);
             }
-        }
+            if (altKey && IsKeyPressed(KEY_M)) showMinimap = !showMinimap;
+            if (altKey && IsKeyPressed(KEY_L)) showGutter = !showGutter;
+            if (altKey && IsKeyPressed(KEY_H)) showSyntax = !showSyntax;
 
-        if (ctrl && IsKeyPressed(KEY_S) && shiftKey) {
-            if (do_save_as(&buf, currentPath, (int)sizeof(currentPath), &hasPath)) {
-                dirty = false;
-                toast_set(&toast, "Saved As", 1.2);
+            // --- File shortcuts (and dirty/toast) ---
+            if (ctrl && IsKeyPressed(KEY_O)) request_path(false, builtinPicker, &picker, &dirCache, &fileDialog, currentPath);
+
+            if (ctrl && IsKeyPressed(KEY_S) && !shiftKey) {
+                if (!hasPath || !currentPath[0]) request_path(true, builtinPicker, &picker, &dirCache, &fileDialog, currentPath);
+                else if (save_to_path(currentPath, &buf)) {
+                    dirty = false;
+                    disk = file_stamp(currentPath);
+                    watch.prompt = false;
+                    toast_set(&toast, "Saved", 1.2);
+                }
             }
-        }
 
-        if (ctrl && IsKeyPressed(KEY_Q)) quitRequested = true;
+            if (ctrl && IsKeyPressed(KEY_S) && shiftKey) request_path(true, builtinPicker, &picker, &dirCache, &fileDialog, currentPath);
 
-        // Edit shortcuts
-        if (ctrl && IsKeyPressed(KEY_A)) { sel.active = true; sel.anchor = 0; sel.caret = buf.len; buf.cursor = buf.len; }
-        if (ctrl && IsKeyPressed(KEY_C) && sel_has(&sel)) {
-            int a = sel_a(&sel), z = sel_z(&sel), n = z - a;
-            char *tmp = (char*)malloc((size_t)n + 1);
-            if (tmp) { memcpy(tmp, buf.data + a, (size_t)n); tmp[n] = '\0'; SetClipboardText(tmp); free(tmp); }
-        }
-        if (ctrl && IsKeyPressed(KEY_X) && sel_has(&sel)) {
-            int a = sel_a(&sel), z = sel_z(&sel), n = z - a;
-            char *tmp = (char*)malloc((size_t)n + 1);
-            if (tmp) { memcpy(tmp, buf.data + a, (size_t)n); tmp[n] = '\0'; SetClipboardText(tmp); free(tmp); }
-            buf_delete_range(&buf, a, z);
-            sel_set_single(&sel, buf.cursor);
-            dirty = true;
-        }
-        if (ctrl && IsKeyPressed(KEY_V)) {
-            const char *clip = GetClipboardText();
-            if (clip && clip[0]) {
-                if (sel_has(&sel)) { buf_delete_range(&buf, sel_a(&sel), sel_z(&sel)); sel_set_single(&sel, buf.cursor); }
-                buf_insert_bytes(&buf, clip, (int)strlen(clip));
+            if (ctrl && IsKeyPressed(KEY_Q)) quitAsked = true;
+
+            if (ctrl && IsKeyPressed(KEY_T)) tabNew = true;
+            if (ctrl && IsKeyPressed(KEY_W)) tabClose = tabs.active;
+            if (ctrl && IsKeyPressed(KEY_TAB) && tabs.count > 1)
+                tabTo = (tabs.active + (shiftKey ? tabs.count - 1 : 1)) % tabs.count;
+
+            // Edit shortcuts
+            if (ctrl && ((IsKeyPressed(KEY_Z) && shiftKey) || IsKeyPressed(KEY_Y))) {
+                if (buf_redo(&buf)) { sel_set_single(&sel, buf.cursor); dirty = true; }
+            } else if (ctrl && IsKeyPressed(KEY_Z)) {
+                if (buf_undo(&buf)) { sel_set_single(&sel, buf.cursor); dirty = true; }
+            }
+            if (ctrl && IsKeyPressed(KEY_G)) { gotoBar = (GotoBar){ .open = true }; menu = MENU_NONE; }
+            if (ctrl && (IsKeyPressed(KEY_F) || IsKeyPressed(KEY_H))) {
+                // Seed the query with a one-line selection.
+                int a = sel_a(&sel), z = sel_z(&sel);
+                if (sel_has(&sel) && z - a < (int)sizeof(findBar.query) && !memchr(buf.data + a, '\n', (size_t)(z - a))) {
+                    memcpy(findBar.query, buf.data + a, (size_t)(z - a));
+                    findBar.query[z - a] = '\0';
+                    findBar.len = z - a;
+                    findBar.useRegex = false;
+                }
+                findBar.open = true;
+                findBar.replacing = IsKeyPressed(KEY_H);
+                findBar.focusWith = findBar.replacing && findBar.len > 0;
+                findBar.origin = sel_has(&sel) ? sel_a(&sel) : buf.cursor;
+                findBar.jumpPending = findBar.len > 0;
+                findBar.stale = true;
+                findBar.notFound = false;
+                menu = MENU_NONE;
+            }
+            if (IsKeyPressed(KEY_F3) && findBar.len > 0) findAction = shiftKey ? FIND_PREV : FIND_NEXT;
+            if (ctrl && IsKeyPressed(KEY_A)) { sel.active = true; sel.anchor = 0; sel.caret = buf.len; buf.cursor = buf.len; }
+            // Keys that only make sense for a plain cursor leave block mode
+            // and then act as usual; Alt+Shift+arrows start or grow a block.
+            bool blockKeys = altKey && shiftKey;
+            if (block.active && !blockKeys &&
+                (IsKeyPressed(KEY_LEFT) || IsKeyPressed(KEY_RIGHT) || IsKeyPressed(KEY_UP) || IsKeyPressed(KEY_DOWN) ||
+                 IsKeyPressed(KEY_HOME) || IsKeyPressed(KEY_END) || IsKeyPressed(KEY_PAGE_UP) || IsKeyPressed(KEY_PAGE_DOWN) ||
+                 IsKeyPressed(KEY_ENTER)))
+                block.active = false;
+            if (!block.active && blockKeys && carets.count <= 1 &&
+                (IsKeyPressed(KEY_LEFT) || IsKeyPressed(KEY_RIGHT) || IsKeyPressed(KEY_UP) || IsKeyPressed(KEY_DOWN)))
+                block_set(&block, &buf, true, curRow, curCol);
+            bool blockOn = block.active;
+            if (blockOn && ctrl && (IsKeyPressed(KEY_C) || IsKeyPressed(KEY_X))) {
+                char *copied = block_copy(&block, &buf);
+                if (copied) { SetClipboardText(copied); free(copied); }
+                if (IsKeyPressed(KEY_X)) { block_clear(&block, &buf); dirty = true; }
+            }
+            if (blockOn && ctrl && IsKeyPressed(KEY_V)) {
+                // A multi-line clipboard goes one line per row, growing the
+                // block downwards to fit; a single line goes on every row.
+                const char *clip = GetClipboardText();
+                if (clip && clip[0]) {
+                    int len = (int)strlen(clip), lines = 1;
+                    for (const char *q = clip; (q = strchr(q, '\n')) != NULL && q + 1 < clip + len; q++) lines++;
+                    if (lines > 1) {
+                        int top = mini(block.anchorRow, block.caretRow);
+                        block.anchorRow = top;
+                        block.caretRow = mini(maxi(block.caretRow, top + lines - 1), total_rows(&buf) - 1);
+                        if (block.caretRow < block.anchorRow) block.caretRow = block.anchorRow;
+                    }
+                    block_fill(&block, &buf, clip, len, lines > 1, UNDO_EDIT);
+                    dirty = true;
+                }
+            }
+
+            bool multi = !blockOn && carets.count > 1;
+            if (ctrl && IsKeyPressed(KEY_D) && carets_add_next(&carets, &sel, &buf)) {
+                carets_sync(&carets, &sel, &buf);
+                multi = carets.count > 1;
+            }
+            if (multi && ctrl && (IsKeyPressed(KEY_C) || IsKeyPressed(KEY_X))) {
+                char *copied = carets_copy(&carets, &buf);
+                if (copied) { SetClipboardText(copied); free(copied); }
+                if (IsKeyPressed(KEY_X)) { carets_type(&carets, &buf, NULL, 0, UNDO_EDIT); dirty = true; }
+            }
+            if (multi && ctrl && IsKeyPressed(KEY_V)) {
+                const char *clip = GetClipboardText();
+                if (clip && clip[0]) { carets_paste(&carets, &buf, clip); dirty = true; }
+            }
+            bool single = !blockOn && !multi;
+            if (single && ctrl && IsKeyPressed(KEY_C) && sel_has(&sel)) buf_copy_to_clipboard(&buf, sel_a(&sel), sel_z(&sel));
+            if (single && ctrl && IsKeyPressed(KEY_X) && sel_has(&sel)) {
+                int a = sel_a(&sel), z = sel_z(&sel);
+                buf_copy_to_clipboard(&buf, a, z);
+                buf_delete_range(&buf, a, z);
                 sel_set_single(&sel, buf.cursor);
                 dirty = true;
             }
-        }
+            if (single && ctrl && IsKeyPressed(KEY_V)) {
+                const char *clip = GetClipboardText();
+                if (clip && clip[0]) {
+                    int a = sel_has(&sel) ? sel_a(&sel) : buf.cursor;
+                    int z = sel_has(&sel) ? sel_z(&sel) : buf.cursor;
+                    buf_replace_range(&buf, a, z, clip, (int)strlen(clip));
+                    sel_set_single(&sel, buf.cursor);
+                    dirty = true;
+                }
+            }
 
-        // Enter
-        if (IsKeyPressed(KEY_ENTER)) {
-            if (sel_has(&sel)) { buf_delete_range(&buf, sel_a(&sel), sel_z(&sel)); sel_set_single(&sel, buf.cursor); }
-            buf_insert_byte(&buf, '\n');
-            sel_set_single(&sel, buf.cursor);
-            dirty = true;
-        }
+            // Repeatable keys. A burst of repeats is applied as a single
+            // edit or a single cursor jump.
+            double now = GetTime();
+            char typed[256];
+            int nTyped = read_typed(typed, (int)sizeof(typed), altKey);
+
+            if (blockOn) {
+                int backs = key_repeat_poll(&keyRepeat, REPEAT_BACKSPACE, now);
+                int dels = key_repeat_poll(&keyRepeat, REPEAT_DELETE, now);
+                if (backs > 0 || dels > 0) { block_delete(&block, &buf, backs, dels); dirty = true; }
+                if (nTyped > 0) { block_fill(&block, &buf, typed, nTyped, false, UNDO_TYPING); dirty = true; }
+
+                int dx = key_repeat_poll(&keyRepeat, REPEAT_RIGHT, now) - key_repeat_poll(&keyRepeat, REPEAT_LEFT, now);
+                int dy = key_repeat_poll(&keyRepeat, REPEAT_DOWN, now) - key_repeat_poll(&keyRepeat, REPEAT_UP, now);
+                if (blockKeys && (dx || dy)) block_set(&block, &buf, false, block.caretRow + dy, block.caretCol + dx);
+                buf.cursor = block_cursor(&block, &buf);
+                sel_set_single(&sel, buf.cursor);
+                cursor_row_col(&buf, &curRow, &curCol);
+                desiredCol = curCol;
+            } else if (multi) {
+                // The same keys at every cursor, each key one batch.
+                int enters = key_repeat_poll(&keyRepeat, REPEAT_ENTER, now);
+                if (enters > 0) {
+                    char newlines[KEY_REPEAT_MAX_BURST];
+                    memset(newlines, '\n', (size_t)enters);
+                    carets_type(&carets, &buf, newlines, enters, UNDO_EDIT);
+                    dirty = true;
+                }
+                int backs = key_repeat_poll(&keyRepeat, REPEAT_BACKSPACE, now);
+                int dels = key_repeat_poll(&keyRepeat, REPEAT_DELETE, now);
+                if (backs > 0 || dels > 0) { carets_delete(&carets, &buf, backs, dels, ctrl); dirty = true; }
+                if (nTyped > 0) { carets_type(&carets, &buf, typed, nTyped, UNDO_TYPING); dirty = true; }
+
+                int rights = key_repeat_poll(&keyRepeat, REPEAT_RIGHT, now);
+                int lefts = key_repeat_poll(&keyRepeat, REPEAT_LEFT, now);
+                if (rights != lefts) carets_move(&carets, &buf, rights, lefts, ctrl, shiftKey);
+                if (IsKeyPressed(KEY_HOME) || IsKeyPressed(KEY_END)) carets_home_end(&carets, &buf, IsKeyPressed(KEY_END), shiftKey);
+                int rowSteps = key_repeat_poll(&keyRepeat, REPEAT_DOWN, now) - key_repeat_poll(&keyRepeat, REPEAT_UP, now);
+                if (rowSteps != 0) carets_move_rows(&carets, &buf, rowSteps, shiftKey);
+                carets_sync(&carets, &sel, &buf);
+                cursor_row_col(&buf, &curRow, &curCol);
+                desiredCol = curCol;
+            } else {
+
+                int enters = key_repeat_poll(&keyRepeat, REPEAT_ENTER, now);
+                if (enters > 0) {
+                    char newlines[KEY_REPEAT_MAX_BURST];
+                    memset(newlines, '\n', (size_t)enters);
+                    int a = sel_has(&sel) ? sel_a(&sel) : buf.cursor;
+                    int z = sel_has(&sel) ? sel_z(&sel) : buf.cursor;
+                    buf_replace_range(&buf, a, z, newlines, enters);
+                    sel_set_single(&sel, buf.cursor);
+                    dirty = true;
+                }
 
-        // Backspace repeat
-        double now = GetTime();
-        bool bsDown = IsKeyDown(KEY_BACKSPACE);
+                int backs = key_repeat_poll(&keyRepeat, REPEAT_BACKSPACE, now);
+                int dels = key_repeat_poll(&keyRepeat, REPEAT_DELETE, now);
+                if (backs > 0 || dels > 0) {
+                    // A selection absorbs the first press; the rest delete
+                    // characters around the cursor.
+                    if (sel_has(&sel)) {
+                        buf_delete_range(&buf, sel_a(&sel), sel_z(&sel));
+                        if (backs > 0) backs--; else dels--;
+                    }
+                    if (ctrl) {
+                        // Word deletes; a run of them is one undo step.
+                        int a = buf.cursor, z = buf.cursor;
+                        for (int i = 0; i < backs; i++) a = word_left(&buf, a);
+                        for (int i = 0; i < dels; i++) z = word_right(&buf, z);
+                        if (a < z) buf_edit(&buf, a, z, NULL, 0, UNDO_DELETE);
+                    } else {
+                        if (backs > 0) buf_delete_range(&buf, buf.cursor - backs, buf.cursor);
+                        if (dels > 0) buf_delete_range(&buf, buf.cursor, buf.cursor + dels);
+                    }
+                    sel_set_single(&sel, buf.cursor);
+                    dirty = true;
+                }
 
-        if (IsKeyPressed(KEY_BACKSPACE)) {
-            if (sel_has(&sel)) buf_delete_range(&buf, sel_a(&sel), sel_z(&sel));
-            else buf_backspace(&buf);
-            sel_set_single(&sel, buf.cursor);
-            bsNext = now + BS_INITIAL_DELAY;
-            bsHeldPrev = true;
-            dirty = true;
-        } else if (bsDown && bsHeldPrev && now >= bsNext) {
-            if (sel_has(&sel)) buf_delete_range(&buf, sel_a(&sel), sel_z(&sel));
-            else buf_backspace(&buf);
-            sel_set_single(&sel, buf.cursor);
-            bsNext = now + BS_REPEAT_RATE;
-            dirty = true;
-        } else if (!bsDown) {
-            bsHeldPrev = false;
-        }
+                // Typing: everything typed this frame goes in as one edit and one
+                // undo step (merged with the typing just before it).
+                if (nTyped > 0) {
+                    int a = sel_has(&sel) ? sel_a(&sel) : buf.cursor;
+                    int z = sel_has(&sel) ? sel_z(&sel) : buf.cursor;
+                    buf_edit(&buf, a, z, typed, nTyped, UNDO_TYPING);
+                    sel_set_single(&sel, buf.cursor);
+                    dirty = true;
+                }
 
-        // Typing
-        int ch = GetCharPressed();
-        while (ch > 0) {
-            if (sel_has(&sel)) { buf_delete_range(&buf, sel_a(&sel), sel_z(&sel)); sel_set_single(&sel, buf.cursor); }
+                // Cursor movement + selection
+                cursor_row_col(&buf, &curRow, &curCol);
 
-            if (ch == 9) {
-                const char *spaces = "    ";
-                buf_insert_bytes(&buf, spaces, 4);
-                dirty = true;
-            } else if (ch >= 32 && ch <= 126) {
-                buf_insert_byte(&buf, (char)ch);
-                dirty = true;
-            }
-            sel_set_single(&sel, buf.cursor);
-            ch = GetCharPressed();
-        }
+                bool shift = shiftKey;
+                if (shift && !sel.active) { sel.active = true; sel.anchor = buf.cursor; sel.caret = buf.cursor; }
 
-        // Cursor movement + selection
-        int curRow = 0, curCol = 0;
-        cursor_row_col(&buf, &curRow, &curCol);
+                int rights = key_repeat_poll(&keyRepeat, REPEAT_RIGHT, now);
+                int lefts = key_repeat_poll(&keyRepeat, REPEAT_LEFT, now);
+                if (rights != lefts) {
+                    if (ctrl) {
+                        for (int i = 0; i < rights; i++) buf.cursor = word_right(&buf, buf.cursor);
+                        for (int i = 0; i < lefts; i++) buf.cursor = word_left(&buf, buf.cursor);
+                    } else {
+                        buf.cursor = clampi(buf.cursor + rights - lefts, 0, buf.len);
+                    }
+                    if (shift) sel.caret = buf.cursor; else sel_set_single(&sel, buf.cursor);
+                }
 
-        bool shift = shiftKey;
-        if (shift && !sel.active) { sel.active = true; sel.anchor = buf.cursor; sel.caret = buf.cursor; }
+                cursor_row_col(&buf, &curRow, &curCol);
 
-        if (IsKeyPressed(KEY_LEFT)) {
-            if (buf.cursor > 0) buf.cursor--;
-            if (shift) sel.caret = buf.cursor; else sel_set_single(&sel, buf.cursor);
-        }
-        if (IsKeyPressed(KEY_RIGHT)) {
-            if (buf.cursor < buf.len) buf.cursor++;
-            if (shift) sel.caret = buf.cursor; else sel_set_single(&sel, buf.cursor);
-        }
+                if (IsKeyPressed(KEY_HOME)) {
+                    if (ctrl) buf.cursor = 0; else move_home(&buf);
+                    if (shift) sel.caret = buf.cursor; else sel_set_single(&sel, buf.cursor);
+                }
+                if (IsKeyPressed(KEY_END)) {
+                    if (ctrl) buf.cursor = buf.len; else move_end(&buf);
+                    if (shift) sel.caret = buf.cursor; else sel_set_single(&sel, buf.cursor);
+                }
 
-        cursor_row_col(&buf, &curRow, &curCol);
+                cursor_row_col(&buf, &curRow, &curCol);
 
-        if (IsKeyPressed(KEY_HOME)) {
-            move_home(&buf);
-            if (shift) sel.caret = buf.cursor; else sel_set_single(&sel, buf.cursor);
-        }
-        if (IsKeyPressed(KEY_END)) {
-            move_end(&buf);
-            if (shift) sel.caret = buf.cursor; else sel_set_single(&sel, buf.cursor);
+                int rowSteps = key_repeat_poll(&keyRepeat, REPEAT_DOWN, now) - key_repeat_poll(&keyRepeat, REPEAT_UP, now);
+                if (rowSteps != 0) {
+                    desiredCol = curCol;
+                    int newRow = clampi(curRow + rowSteps, 0, total_rows(&buf) - 1);
+                    buf.cursor = index_at_row_col(&buf, newRow, desiredCol);
+                    if (shift) sel.caret = buf.cursor; else sel_set_single(&sel, buf.cursor);
+                }
+
+                // Paging moves the view and the cursor together by a screenful.
+                int pages = key_repeat_poll(&keyRepeat, REPEAT_PAGE_DOWN, now) - key_repeat_poll(&keyRepeat, REPEAT_PAGE_UP, now);
+                if (pages != 0) {
+                    desiredCol = curCol;
+                    int newRow = clampi(curRow + pages * visibleRows, 0, total_rows(&buf) - 1);
+                    buf.cursor = index_at_row_col(&buf, newRow, desiredCol);
+                    scroll_to(&scroll, scroll.pos + (float)(pages * visibleRows), maxScroll);
+                    if (shift) sel.caret = buf.cursor; else sel_set_single(&sel, buf.cursor);
+                }
+
+                cursor_row_col(&buf, &curRow, &curCol);
+                if (!shift) desiredCol = curCol;
+            }
         }
 
-        cursor_row_col(&buf, &curRow, &curCol);
+        if (findAction == FIND_REPLACE_ALL) {
+            if (replace_start(&replaceJob, &findBar, &buf)) menu = MENU_NONE;
+        } else if (findAction != FIND_NONE) {
+            ReMatch m;
+            bool found = findAction == FIND_NEXT
+                ? find_next(&findBar, &buf, sel_has(&sel) ? sel_z(&sel) : buf.cursor, &m)
+                : find_prev(&findBar, &buf, sel_has(&sel) ? sel_a(&sel) : buf.cursor, &m);
+            findBar.notFound = !found && !findBar.err;
+            if (found) {
+                sel.active = true;
+                sel.anchor = m.a;
+                sel.caret = m.z;
+                buf.cursor = m.z;
+                cursor_row_col(&buf, &curRow, &curCol);
+                desiredCol = curCol;
+            }
+        }
 
-        if (IsKeyPressed(KEY_UP)) {
-            desiredCol = curCol;
-            int newRow = (curRow > 0) ? curRow - 1 : 0;
-            buf.cursor = index_at_row_col(&buf, newRow, desiredCol);
-            if (shift) sel.caret = buf.cursor; else sel_set_single(&sel, buf.cursor);
+        // Find as you type: the hit set grows a slice per frame, and the
+        // selection moves to the first match past the origin once it is known.
+        if (findBar.open && !replace_running(&replaceJob)) {
+            find_scan(&findBar, &buf, 0.004);
+            ReMatch m;
+            if (findBar.jumpPending && find_jump_target(&findBar, &buf, &m)) {
+                findBar.jumpPending = false;
+                sel.active = true;
+                sel.anchor = m.a;
+                sel.caret = m.z;
+                buf.cursor = m.z;
+                cursor_row_col(&buf, &curRow, &curCol);
+                desiredCol = curCol;
+            } else if (findBar.jumpPending && findBar.scanDone) findBar.jumpPending = false;
         }
-        if (IsKeyPressed(KEY_DOWN)) {
-            desiredCol = curCol;
-            int maxRow2 = total_rows(&buf) - 1;
-            int newRow = (curRow < maxRow2) ? curRow + 1 : maxRow2;
-            buf.cursor = index_at_row_col(&buf, newRow, desiredCol);
-            if (shift) sel.caret = buf.cursor; else sel_set_single(&sel, buf.cursor);
+
+        int replaced = replace_poll(&replaceJob);
+        if (replaced == REPLACE_DONE && replaceJob.count == 0) {
+            free(replaceJob.out);
+            li_free(&replaceJob.lines);
+            findBar.notFound = true;
+        } else if (replaced == REPLACE_DONE) {
+            buf_replace_text(&buf, replaceJob.out, replaceJob.outLen, replaceJob.lines, replaceJob.cursorOut);
+            sel_set_single(&sel, buf.cursor);
+            dirty = true;
+            char msg[64];
+            snprintf(msg, sizeof(msg), "Replaced %d match%s", replaceJob.count, replaceJob.count == 1 ? "" : "es");
+            toast_set(&toast, msg, 1.5);
+        } else if (replaced == REPLACE_FAILED) toast_set(&toast, "Replace failed: out of memory", 1.5);
+
+        // The file changed on disk: an append is followed in place, a rewrite
+        // is taken with the cursor and scroll kept where they were, and over
+        // unsaved edits the user is asked first.
+        watch_set(&watch, hasPath ? currentPath : "");
+        if ((watch_poll(&watch) || watch.reload) && !replace_running(&replaceJob)) {
+            FileStamp now = file_stamp(currentPath);
+            bool reload = watch.reload;
+            watch.reload = false;
+            if (now.valid && (reload || !stamp_same(&now, &disk))) {
+                bool atEnd = buf.cursor == buf.len && !sel.active && carets.count <= 1 && !block.active;
+                int top = (int)scroll.pos;
+                if (dirty && !reload) {
+                    watch.prompt = true;
+                } else if (!reload && buf_follow_append(&buf, currentPath, &disk, &now)) {
+                    if (atEnd) { buf.cursor = buf.len; sel_set_single(&sel, buf.cursor); }
+                } else if (buf_follow_rewrite(&buf, currentPath, dirty, &top)) {
+                    disk = now;
+                    dirty = false;
+                    scroll.pos = (float)top + (scroll.pos - floorf(scroll.pos));
+                    sel_set_single(&sel, buf.cursor);
+                    carets_clear(&carets);
+                    block.active = false;
+                    prevCursor = buf.cursor;
+                }
+                cursor_row_col(&buf, &curRow, &curCol);
+            }
         }
 
-        cursor_row_col(&buf, &curRow, &curCol);
-        if (!shift) desiredCol = curCol;
+        carets_check(&carets, &sel, &buf);
+        block_check(&block, &buf);
+
+        // Edits may have changed the row count.
+        rows = total_rows(&buf);
+        maxScroll = maxi(rows - visibleRows, 0);
+
+        // Keep the caret in view only when it moved, so the wheel and the
+        // scrollbar can look elsewhere.
+        scroll_step(&scroll, GetFrameTime(), maxScroll);
+        if (buf.cursor != prevCursor) {
+            if ((float)curRow < scroll.pos) scroll_to(&scroll, (float)curRow, maxScroll);
+            if ((float)(curRow + 1) > scroll.pos + visibleRows) scroll_to(&scroll, (float)(curRow + 1 - visibleRows), maxScroll);
+        }
+        int scrollRow = (int)scroll.pos;
+        float scrollOffY = (scroll.pos - (float)scrollRow) * lineH;
+
+        if (!wrapLines) {
+            // Follow the caret horizontally only when it moved, so wheel
+            // scrolling can look away from it.
+            if (buf.cursor != prevCursor) {
+                float caretX = curCol * charW;
+                if (caretX < scrollX) scrollX = caretX;
+                if (caretX + charW > scrollX + textArea.width) scrollX = caretX + charW - textArea.width;
+            }
 
-        if (curRow < scrollRow) scrollRow = curRow;
-        if (curRow >= scrollRow + visibleRows) scrollRow = curRow - visibleRows + 1;
-        scrollRow = clampi(scrollRow, 0, maxScroll);
+            // Bound the scroll by the longest line on screen; that is all
+            // that can be looked at without moving vertically.
+            int widest = 0;
+            for (int r = scrollRow; r < rows && r < scrollRow + visibleRows; r++) widest = maxi(widest, line_length_at_row(&buf, r));
+            float maxScrollX = widest * charW + charW - textArea.width;
+            if (maxScrollX < 0.0f) maxScrollX = 0.0f;
+            float caretEdge = curCol * charW + charW - textArea.width;
+            if (caretEdge > maxScrollX) maxScrollX = caretEdge;
+            if (scrollX > maxScrollX) scrollX = maxScrollX;
+        }
+        prevCursor = buf.cursor;
+
+        // The minimap and the lexer states follow only the rows this frame's
+        // edits touched.
+        int ta, tz, tt;
+        bool touched = buf_take_touched(&buf, &ta, &tz, &tt);
+        if (touched) syn_edit(&syntax, ta, tt, total_rows(&buf));
+        if (showMinimap) mm_layout(&minimap, (int)mmTex.height, total_rows(&buf));
+        if (touched) mm_invalidate_rows(&minimap, ta, tz);
+        if (showMinimap) mm_update(&minimap, &buf, (Color){ 150, 160, 175, 200 }, 0.002);
+
+        // Visible rows get their states first; the rest of the file fills in
+        // a slice per frame.
+        if (showSyntax) {
+            syn_run(&syntax, &buf, scrollRow + visibleRows + 1, GetTime() + 0.008);
+            syn_run(&syntax, &buf, INT_MAX, GetTime() + 0.002);
+        }
 
         // ---------- DRAW ----------
         BeginDrawing();
@@ -625,80 +5675,198 @@ int main(void) {
         int cursorLineLen   = cursorLineEnd - cursorLineStart;
         int cursorOffInLine = clampi(buf.cursor - cursorLineStart, 0, cursorLineLen);
 
-        float maxTextWidth = textArea.width;
-
-        int lineIdx = line_start_index(&buf, scrollRow);
-        int drawnVisual = 0;
+        // A block draws its own caret column on every row.
+        bool blockCaretOn = cursorOn;
+        if (block.active) cursorOn = false;
+
+        // Text goes out as one glyph batch per pass; the caret is drawn over it.
+        Rectangle caretRect = { 0 };
+        bool caretShown = false;
+
+        if (wrapLines) {
+            float maxTextWidth = textArea.width;
+
+            int lineIdx = line_start_index(&buf, scrollRow);
+            int drawnVisual = 0;
+            float top = textArea.y - scrollOffY;
+
+            // One extra row covers the partly scrolled-in line at the bottom.
+            BeginScissorMode(cardX, (int)textArea.y, cardW, (int)textArea.height);
+            for (int row = scrollRow; row < total_rows(&buf) && drawnVisual <= visibleRows; row++) {
+                int end = line_end_index(&buf, lineIdx);
+                int lineLen = end - lineIdx;
+
+                if (showGutter)
+                    gutter_draw(&gutter, &glyphs, charW, gutterRight, top + drawnVisual * lineH,
+                                row, row == curRow ? text : muted);
+
+                const unsigned char *rowStyles = showSyntax ? syn_row_styles(&syntax, &buf, row, lineIdx, end, lineLen) : NULL;
+
+                if (lineLen == 0) {
+                    float y = top + drawnVisual * lineH;
+                    if (block.active)
+                        block_draw(&block, &buf, row, 0, 0, true, textArea.x, textArea.x, textArea.x + textArea.width,
+                                   y, fontSize, charW, selBg, accent, blockCaretOn);
+                    if (cursorOn && row == curRow && cursorOffInLine == 0) {
+                        caretRect = (Rectangle){ (float)(int)textArea.x, (float)(int)(y + 4), 2, (float)(int)(fontSize + 4) };
+                        caretShown = true;
+                    }
+                    drawnVisual++;
+                } else {
+                    int off = 0;
+                    while (off < lineLen && drawnVisual <= visibleRows) {
+                        float y = top + drawnVisual * lineH;
+
+                        int remaining = lineLen - off;
+                        int take = wrap_fit_count(editorFont, fontSize, maxTextWidth, buf.data + lineIdx + off, remaining);
+                        if (take <= 0) take = 1;
+                        if (take > remaining) take = remaining;
+
+                        char tmp[4096] = {0};
+                        int n = (take < (int)sizeof(tmp) - 1) ? take : (int)sizeof(tmp) - 1;
+                        memcpy(tmp, buf.data + lineIdx + off, (size_t)n);
+                        tmp[n] = '\0';
+
+                        if (findBar.open)
+                            find_hits_draw(&findBar, &buf, lineIdx + off, lineIdx + off + take, lineIdx, end,
+                                           textArea.x, textArea.x, textArea.x + textArea.width, y + 3, fontSize + 6, charW, hitBg);
+                        if (carets.count > 1)
+                            carets_draw(&carets, lineIdx + off, lineIdx + off + take, end, textArea.x, textArea.x,
+                                        textArea.x + textArea.width, y, fontSize, charW, selBg, accent, cursorOn);
+                        if (block.active)
+                            block_draw(&block, &buf, row, off, off + take, off + take == lineLen, textArea.x, textArea.x,
+                                       textArea.x + textArea.width, y, fontSize, charW, selBg, accent, blockCaretOn);
+
+                        if (sel_has(&sel)) {
+                            int a = sel_a(&sel), z = sel_z(&sel);
+                            int segA = lineIdx + off;
+                            int segZ = lineIdx + off + take;
+                            int hiA = maxi(a, segA);
+                            int hiZ = mini(z, segZ);
+                            if (hiZ > hiA) {
+                                int colA = hiA - segA;
+                                int colZ = hiZ - segA;
+                                float x1 = textArea.x + colA * charW;
+                                float x2 = textArea.x + colZ * charW;
+                                DrawRectangle((int)x1, (int)(y + 3), (int)(x2 - x1), (int)(fontSize + 6), selBg);
+                            }
+                        }
 
-        for (int row = scrollRow; row < total_rows(&buf) && drawnVisual < visibleRows; row++) {
-            int end = line_end_index(&buf, lineIdx);
-            int lineLen = end - lineIdx;
+                        glyphs_add(&glyphs, tmp, n, rowStyles ? rowStyles + off : NULL, (Vector2){ textArea.x, y }, charW, text);
 
-            if (lineLen == 0) {
-                float y = textArea.y + drawnVisual * lineH;
-                if (cursorOn && row == curRow && cursorOffInLine == 0) {
-                    DrawRectangle((int)textArea.x, (int)(y + 4), 2, (int)(fontSize + 4), accent);
-                }
-                drawnVisual++;
-            } else {
-                int off = 0;
-                while (off < lineLen && drawnVisual < visibleRows) {
-                    float y = textArea.y + drawnVisual * lineH;
+                        if (cursorOn && row == curRow) {
+                            bool lastSeg = (off + take == lineLen);
+                            bool caretHere =
+                                (cursorOffInLine >= off && cursorOffInLine < off + take) ||
+                                (lastSeg && cursorOffInLine == lineLen);
 
-                    int remaining = lineLen - off;
-                    int take = wrap_fit_count(editorFont, fontSize, maxTextWidth, buf.data + lineIdx + off, remaining);
-                    if (take <= 0) take = 1;
-                    if (take > remaining) take = remaining;
+                            if (caretHere) {
+                                int caretLocal = cursorOffInLine - off;
+                                if (lastSeg && cursorOffInLine == lineLen) caretLocal = take;
 
-                    char tmp[4096] = {0};
-                    int n = (take < (int)sizeof(tmp) - 1) ? take : (int)sizeof(tmp) - 1;
-                    memcpy(tmp, buf.data + lineIdx + off, (size_t)n);
-                    tmp[n] = '\0';
+                                char left[4096];
+                                int leftLen = clampi(caretLocal, 0, n);
+                                if (leftLen > 0) memcpy(left, tmp, (size_t)leftLen);
+                                left[leftLen] = '\0';
 
-                    if (sel_has(&sel)) {
-                        int a = sel_a(&sel), z = sel_z(&sel);
-                        int segA = lineIdx + off;
-                        int segZ = lineIdx + off + take;
-                        int hiA = maxi(a, segA);
-                        int hiZ = mini(z, segZ);
-                        if (hiZ > hiA) {
-                            int colA = hiA - segA;
-                            int colZ = hiZ - segA;
-                            float x1 = textArea.x + colA * charW;
-                            float x2 = textArea.x + colZ * charW;
-                            DrawRectangle((int)x1, (int)(y + 3), (int)(x2 - x1), (int)(fontSize + 6), selBg);
+                                float cx = textArea.x + MeasureTextEx(editorFont, left, fontSize, 0).x;
+                                caretRect = (Rectangle){ (float)(int)cx, (float)(int)(y + 4), 2, (float)(int)(fontSize + 4) };
+                                caretShown = true;
+                            }
                         }
-                    }
 
-                    DrawTextEx(editorFont, tmp, (Vector2){ textArea.x, y }, fontSize, 0, text);
+                        drawnVisual++;
+                        off += take;
+                    }
+                }
 
-                    if (cursorOn && row == curRow) {
-                        bool lastSeg = (off + take == lineLen);
-                        bool caretHere =
-                            (cursorOffInLine >= off && cursorOffInLine < off + take) ||
-                            (lastSeg && cursorOffInLine == lineLen);
+                if (end >= buf.len) break;
+                lineIdx = end + 1;
+            }
+            glyphs_flush(&glyphs);
+            if (caretShown) DrawRectangleRec(caretRect, accent);
+            EndScissorMode();
+        } else {
+            // Start column comes straight from the monospace advance; the
+            // rest of each line is never touched.
+            int firstCol = (int)(scrollX / charW);
+            float originX = textArea.x - (scrollX - firstCol * charW);
+            int visCols = (int)(textArea.width / charW) + 2;
+
+            float top = textArea.y - scrollOffY;
+
+            if (showGutter) {
+                BeginScissorMode(cardX, (int)textArea.y, cardW, (int)textArea.height);
+                for (int r = 0; r <= visibleRows && scrollRow + r < rows; r++)
+                    gutter_draw(&gutter, &glyphs, charW, gutterRight, top + r * lineH,
+                                scrollRow + r, scrollRow + r == curRow ? text : muted);
+                glyphs_flush(&glyphs);
+                EndScissorMode();
+            }
 
-                        if (caretHere) {
-                            int caretLocal = cursorOffInLine - off;
-                            if (lastSeg && cursorOffInLine == lineLen) caretLocal = take;
+            BeginScissorMode((int)textArea.x - 2, (int)textArea.y, (int)textArea.width + 4, (int)textArea.height);
+            for (int r = 0; r <= visibleRows && scrollRow + r < rows; r++) {
+                int row = scrollRow + r;
+                float y = top + r * lineH;
+                int ls = line_start_index(&buf, row);
+                int le = line_end_index(&buf, ls);
+                int lineLen = le - ls;
+
+                if (findBar.open && firstCol < lineLen) {
+                    int segA = ls + firstCol;
+                    find_hits_draw(&findBar, &buf, segA, mini(le, segA + visCols), ls, le, originX,
+                                   textArea.x, textArea.x + textArea.width, y + 3, fontSize + 6, charW, hitBg);
+                }
+                if (carets.count > 1)
+                    carets_draw(&carets, ls, le, le, textArea.x - scrollX, textArea.x, textArea.x + textArea.width,
+                                y, fontSize, charW, selBg, accent, cursorOn);
+                if (block.active)
+                    block_draw(&block, &buf, row, 0, lineLen, true, textArea.x - scrollX, textArea.x, textArea.x + textArea.width,
+                               y, fontSize, charW, selBg, accent, blockCaretOn);
+
+                if (sel_has(&sel)) {
+                    int hiA = maxi(sel_a(&sel), ls);
+                    int hiZ = mini(sel_z(&sel), le);
+                    if (hiZ > hiA) {
+                        float x1 = textArea.x + (hiA - ls) * charW - scrollX;
+                        float x2 = textArea.x + (hiZ - ls) * charW - scrollX;
+                        if (x1 < textArea.x) x1 = textArea.x;
+                        if (x2 > textArea.x + textArea.width) x2 = textArea.x + textArea.width;
+                        if (x2 > x1) DrawRectangle((int)x1, (int)(y + 3), (int)(x2 - x1), (int)(fontSize + 6), selBg);
+                    }
+                }
 
-                            char left[4096];
-                            int leftLen = clampi(caretLocal, 0, n);
-                            if (leftLen > 0) memcpy(left, tmp, (size_t)leftLen);
-                            left[leftLen] = '\0';
+                if (firstCol < lineLen) {
+                    int n = mini(lineLen - firstCol, visCols);
+                    const unsigned char *rowStyles = showSyntax ? syn_row_styles(&syntax, &buf, row, ls, le, firstCol + n) : NULL;
+                    glyphs_add(&glyphs, buf.data + ls + firstCol, n, rowStyles ? rowStyles + firstCol : NULL,
+                               (Vector2){ originX, y }, charW, text);
+                }
 
-                            float cx = textArea.x + MeasureTextEx(editorFont, left, fontSize, 0).x;
-                            DrawRectangle((int)cx, (int)(y + 4), 2, (int)(fontSize + 4), accent);
-                        }
+                if (cursorOn && row == curRow) {
+                    float cx = textArea.x + cursorOffInLine * charW - scrollX;
+                    if (cx >= textArea.x - 1 && cx <= textArea.x + textArea.width) {
+                        caretRect = (Rectangle){ (float)(int)cx, (float)(int)(y + 4), 2, (float)(int)(fontSize + 4) };
+                        caretShown = true;
                     }
-
-                    drawnVisual++;
-                    off += take;
                 }
             }
+            glyphs_flush(&glyphs);
+            if (caretShown) DrawRectangleRec(caretRect, accent);
+            EndScissorMode();
+        }
+
+        scrollbar_draw(&scroll, sbTrack, visibleRows, rows, mouse, (Color){ 51, 60, 75, 255 }, muted);
 
-            if (end >= buf.len) break;
-            lineIdx = end + 1;
+        if (showMinimap && minimap.px) {
+            DrawRectangleRounded(mmArea, 0.08f, 12, panel);
+            DrawRectangleRoundedLines(mmArea, 0.08f, 12, border);
+            DrawTextureRec(minimap.tex, (Rectangle){ 0, 0, MINIMAP_W, (float)minimap.texH }, (Vector2){ mmTex.x, mmTex.y }, WHITE);
+
+            float vy = mmTex.y + scroll.pos / minimap.linesPerPx;
+            float vh = (float)visibleRows / minimap.linesPerPx;
+            if (vh < 2.0f) vh = 2.0f;
+            DrawRectangle((int)mmTex.x, (int)vy, MINIMAP_W, (int)vh, (Color){ 96, 165, 250, 40 });
         }
 
         // Top bar (draw after editor)
@@ -708,16 +5876,29 @@ int main(void) {
         // Dirty dot (ONLY when dirty)
         if (dirty) DrawCircle(w - 18, 22, 5, accent);
 
+        int tabHit, tabHitClose;
+        tabs_draw(&tabs, &live, (float)cardX, (float)topBarH + 1, (float)cardW,
+                  !picker.open && !replace_running(&replaceJob) && atomic_load(&fileDialog.state) == DIALOG_IDLE &&
+                  menu == MENU_NONE,
+                  uiFont, 14.0f, text, muted, accent, border, &tabHit, &tabHitClose);
+        if (tabHit >= 0) tabTo = tabHit;
+        if (tabHitClose >= 0) tabClose = tabHitClose;
+
         Rectangle fileBtn = (Rectangle){ 90, 8, 70, 28 };
         Rectangle editBtn = (Rectangle){ 170, 8, 70, 28 };
+        Rectangle viewBtn = (Rectangle){ 250, 8, 70, 28 };
 
         bool clickFile = ui_button(fileBtn, "File", uiFont, uiSize,
                                   (Color){28,33,41,255}, (Color){33,39,49,255}, (Color){40,46,58,255}, text);
         bool clickEdit = ui_button(editBtn, "Edit", uiFont, uiSize,
                                   (Color){28,33,41,255}, (Color){33,39,49,255}, (Color){40,46,58,255}, text);
+        bool clickView = ui_button(viewBtn, "View", uiFont, uiSize,
+                                  (Color){28,33,41,255}, (Color){33,39,49,255}, (Color){40,46,58,255}, text);
 
         if (clickFile) menu = (menu == MENU_FILE) ? MENU_NONE : MENU_FILE;
         if (clickEdit) menu = (menu == MENU_EDIT) ? MENU_NONE : MENU_EDIT;
+        if (clickView) menu = (menu == MENU_VIEW) ? MENU_NONE : MENU_VIEW;
+        if (replace_running(&replaceJob)) menu = MENU_NONE;
 
         // Dropdowns (draw LAST so they are not “transparent”)
         bool clickedItem = false;
@@ -733,34 +5914,31 @@ int main(void) {
             Rectangle r4 = (Rectangle){ drop.x, drop.y + 84, drop.width, 28 };
 
             if (menu_item_lr(r1, "Open…", "Ctrl+O", uiFont, uiSize, text)) {
-                if (do_open(&buf, &sel, &scrollRow, currentPath, (int)sizeof(currentPath), &hasPath)) {
-                    dirty = false;
-                    toast_set(&toast, "Opened", 1.0);
-                }
+                request_path(false, builtinPicker, &picker, &dirCache, &fileDialog, currentPath);
                 clickedItem = true; menu = MENU_NONE;
             }
             if (menu_item_lr(r2, "Save", "Ctrl+S", uiFont, uiSize, text)) {
-                if (do_save(&buf, currentPath, (int)sizeof(currentPath), &hasPath)) {
+                if (!hasPath || !currentPath[0]) request_path(true, builtinPicker, &picker, &dirCache, &fileDialog, currentPath);
+                else if (save_to_path(currentPath, &buf)) {
                     dirty = false;
+                    disk = file_stamp(currentPath);
+                    watch.prompt = false;
                     toast_set(&toast, "Saved", 1.2);
                 }
                 clickedItem = true; menu = MENU_NONE;
             }
             if (menu_item_lr(r3, "Save As…", "Ctrl+Shift+S", uiFont, uiSize, text)) {
-                if (do_save_as(&buf, currentPath, (int)sizeof(currentPath), &hasPath)) {
-                    dirty = false;
-                    toast_set(&toast, "Saved As", 1.2);
-                }
+                request_path(true, builtinPicker, &picker, &dirCache, &fileDialog, currentPath);
                 clickedItem = true; menu = MENU_NONE;
             }
             if (menu_item_lr(r4, "Quit", "Ctrl+Q", uiFont, uiSize, text)) {
-                quitRequested = true;
+                quitAsked = true;
                 clickedItem = true; menu = MENU_NONE;
             }
         }
 
         if (menu == MENU_EDIT) {
-            Rectangle drop = (Rectangle){ editBtn.x, editBtn.y + editBtn.height + 6, 240, 4*28 };
+            Rectangle drop = (Rectangle){ editBtn.x, editBtn.y + editBtn.height + 6, 240, 6*28 };
             DrawRectangleRounded(drop, 0.10f, 10, (Color){28,33,41,255});
             DrawRectangleRoundedLines(drop, 0.10f, 10, border);
 
@@ -768,6 +5946,8 @@ int main(void) {
             Rectangle r2 = (Rectangle){ drop.x, drop.y + 28, drop.width, 28 };
             Rectangle r3 = (Rectangle){ drop.x, drop.y + 56, drop.width, 28 };
             Rectangle r4 = (Rectangle){ drop.x, drop.y + 84, drop.width, 28 };
+            Rectangle r5 = (Rectangle){ drop.x, drop.y + 112, drop.width, 28 };
+            Rectangle r6 = (Rectangle){ drop.x, drop.y + 140, drop.width, 28 };
 
             if (menu_item_lr(r1, "Cut", "Ctrl+X", uiFont, uiSize, text)) { clickedItem = true; menu = MENU_NONE; }
             if (menu_item_lr(r2, "Copy", "Ctrl+C", uiFont, uiSize, text)) { clickedItem = true; menu = MENU_NONE; }
@@ -776,13 +5956,56 @@ int main(void) {
                 sel.active = true; sel.anchor = 0; sel.caret = buf.len; buf.cursor = buf.len;
                 clickedItem = true; menu = MENU_NONE;
             }
+            if (menu_item_lr(r5, "Undo", "Ctrl+Z", uiFont, uiSize, text)) {
+                if (buf_undo(&buf)) { sel_set_single(&sel, buf.cursor); dirty = true; }
+                clickedItem = true; menu = MENU_NONE;
+            }
+            if (menu_item_lr(r6, "Redo", "Ctrl+Y", uiFont, uiSize, text)) {
+                if (buf_redo(&buf)) { sel_set_single(&sel, buf.cursor); dirty = true; }
+                clickedItem = true; menu = MENU_NONE;
+            }
+        }
+
+        if (menu == MENU_VIEW) {
+            Rectangle drop = (Rectangle){ viewBtn.x, viewBtn.y + viewBtn.height + 6, 240, 5*28 };
+            DrawRectangleRounded(drop, 0.10f, 10, (Color){28,33,41,255});
+            DrawRectangleRoundedLines(drop, 0.10f, 10, border);
+
+            Rectangle r1 = (Rectangle){ drop.x, drop.y + 0,  drop.width, 28 };
+            Rectangle r2 = (Rectangle){ drop.x, drop.y + 28, drop.width, 28 };
+            Rectangle r3 = (Rectangle){ drop.x, drop.y + 56, drop.width, 28 };
+            Rectangle r4 = (Rectangle){ drop.x, drop.y + 84, drop.width, 28 };
+            Rectangle r5 = (Rectangle){ drop.x, drop.y + 112, drop.width, 28 };
+
+            if (menu_item_lr(r1, wrapLines ? "Word Wrap (on)" : "Word Wrap (off)", "Alt+Z", uiFont, uiSize, text)) {
+                wrapLines = !wrapLines;
+                scrollX = 0.0f;
+                clickedItem = true; menu = MENU_NONE;
+            }
+            if (menu_item_lr(r2, showMinimap ? "Minimap (on)" : "Minimap (off)", "Alt+M", uiFont, uiSize, text)) {
+                showMinimap = !showMinimap;
+                clickedItem = true; menu = MENU_NONE;
+            }
+            if (menu_item_lr(r3, showGutter ? "Line Numbers (on)" : "Line Numbers (off)", "Alt+L", uiFont, uiSize, text)) {
+                showGutter = !showGutter;
+                clickedItem = true; menu = MENU_NONE;
+            }
+            if (menu_item_lr(r4, showSyntax ? "Syntax Colors (on)" : "Syntax Colors (off)", "Alt+H", uiFont, uiSize, text)) {
+                showSyntax = !showSyntax;
+                clickedItem = true; menu = MENU_NONE;
+            }
+            if (menu_item_lr(r5, builtinPicker ? "Built-in File Picker (on)" : "Built-in File Picker (off)", "", uiFont, uiSize, text)) {
+                builtinPicker = !builtinPicker;
+                clickedItem = true; menu = MENU_NONE;
+            }
         }
 
         if (menu != MENU_NONE && IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && !clickedItem) {
             Rectangle dropArea = (Rectangle){0,0,0,0};
             if (menu == MENU_FILE) dropArea = (Rectangle){ fileBtn.x, fileBtn.y + fileBtn.height + 6, 240, 4*28 };
-            if (menu == MENU_EDIT) dropArea = (Rectangle){ editBtn.x, editBtn.y + editBtn.height + 6, 240, 4*28 };
-            bool inBtns = CheckCollisionPointRec(mouse, fileBtn) || CheckCollisionPointRec(mouse, editBtn);
+            if (menu == MENU_EDIT) dropArea = (Rectangle){ editBtn.x, editBtn.y + editBtn.height + 6, 240, 6*28 };
+            if (menu == MENU_VIEW) dropArea = (Rectangle){ viewBtn.x, viewBtn.y + viewBtn.height + 6, 240, 5*28 };
+            bool inBtns = CheckCollisionPointRec(mouse, fileBtn) || CheckCollisionPointRec(mouse, editBtn) || CheckCollisionPointRec(mouse, viewBtn);
             bool inDrop = CheckCollisionPointRec(mouse, dropArea);
             if (!inBtns && !inDrop) menu = MENU_NONE;
         }
@@ -791,11 +6014,24 @@ int main(void) {
         DrawRectangle(0, h - 34, w, 34, panel);
         const char *name = hasPath ? base_name(currentPath) : "(untitled)";
         char status[512];
-        snprintf(status, sizeof(status),
-                 "%s  |  Ctrl+O Open  Ctrl+S Save  Ctrl+Shift+S Save As  |  Ctrl+C/X/V/A  |  Row %d Col %d   (Esc quits)",
-                 name, curRow + 1, curCol + 1);
+        if (replace_running(&replaceJob))
+            snprintf(status, sizeof(status), "%s  |  Replacing… %d%%   (Esc cancels)", name, replace_percent(&replaceJob));
+        else
+            snprintf(status, sizeof(status),
+                     "%s  |  Ctrl+O Open  Ctrl+S Save  Ctrl+Shift+S Save As  |  Ctrl+C/X/V/A  |  Row %d Col %d   (Esc quits)",
+                     name, curRow + 1, curCol + 1);
         draw_text(uiFont, status, 16, (float)h - 24, 14.0f, muted);
 
+        // Memory: this document, all documents, and the budget.
+        char memDoc[32], memAll[32], memBudget[32], mem[128];
+        format_bytes(memDoc, sizeof(memDoc), liveBytes);
+        format_bytes(memAll, sizeof(memAll), tabs_total(&tabs, liveBytes));
+        format_bytes(memBudget, sizeof(memBudget), tabs.budget);
+        snprintf(mem, sizeof(mem), "Mem %s  |  all %s of %s", memDoc, memAll, memBudget);
+        Vector2 memW = MeasureTextEx(uiFont, mem, 14.0f, 0);
+        if (MeasureTextEx(uiFont, status, 14.0f, 0).x + memW.x + 48 <= w)
+            draw_text(uiFont, mem, (float)w - memW.x - 16, (float)h - 24, 14.0f, muted);
+
         // Toast popup (top-right, under the title bar)
         if (toast.until > GetTime() && toast.msg[0]) {
             Vector2 tw = MeasureTextEx(uiFont, toast.msg, 16.0f, 0);
@@ -809,9 +6045,143 @@ int main(void) {
             draw_text(uiFont, toast.msg, box.x + padX, box.y + padY - 1, 16.0f, text);
         }
 
+        if (findBar.open) {
+            bool all = find_draw(&findBar, (Rectangle){ (float)cardX, (float)cardY, (float)cardW, (float)cardH },
+                                 uiFont, uiSize, text, muted, accent, border);
+            if (all && !replace_running(&replaceJob)) replace_start(&replaceJob, &findBar, &buf);
+        }
+
+        if (gotoBar.open) {
+            goto_draw(&gotoBar, (Rectangle){ (float)cardX, (float)cardY, (float)cardW, (float)cardH },
+                      total_rows(&buf), uiFont, uiSize, text, muted, accent, border);
+        }
+
+        if (watch.prompt) {
+            int choice = watch_prompt_draw((Rectangle){ (float)cardX, (float)cardY, (float)cardW, (float)cardH },
+                                           name, uiFont, uiSize, text, muted, border);
+            if (choice) watch.prompt = false;
+            if (choice > 0) watch.reload = true;
+            if (choice < 0) disk = file_stamp(currentPath);
+        }
+
+        if (picker.open) {
+            picker_draw(&picker, &dirCache, (Rectangle){ (float)cardX, (float)cardY, (float)cardW, (float)cardH },
+                        uiFont, uiSize, text, muted, accent, border);
+        }
+
+        // Paths chosen by the built-in picker or an external dialog land here.
+        const char *chosen = NULL;
+        bool chosenSave = false;
+        if (picker.open && picker.result == PICK_CHOSEN) { chosen = picker.chosen; chosenSave = picker.saving; }
+        if (async_dialog_poll(&fileDialog)) {
+            restore_cursor_now();
+            if (fileDialog.result[0]) { chosen = fileDialog.result; chosenSave = fileDialog.saving; }
+        }
+        if (chosen && chosenSave) {
+            if (save_as_path(chosen, &buf, currentPath, (int)sizeof(currentPath), &hasPath)) {
+                syn_set_lang(&syntax, syn_lang_for(currentPath, &buf), total_rows(&buf));
+                dirty = false;
+                disk = file_stamp(currentPath);
+                watch.prompt = false;
+                toast_set(&toast, "Saved As", 1.2);
+            } else toast_set(&toast, "Save failed", 1.5);
+        } else if (chosen && (tabTo = tabs_find(&tabs, chosen, &live)) < 0) {
+            replace_cancel(&replaceJob);
+            // An untouched untitled tab takes the file; otherwise it gets a new one.
+            int back = tabs.active;
+            bool fresh = (hasPath || dirty || buf.len > 0) && tabs_push(&tabs);
+            if (fresh) tabs_activate(&tabs, tabs.count - 1, &live);
+            // Stamped before the read, so a write landing during it shows up
+            // as a change rather than as bytes the text never got.
+            FileStamp opened = file_stamp(chosen);
+            if (open_path(chosen, &buf, &sel, &scroll.pos, currentPath, (int)sizeof(currentPath), &hasPath)) {
+                syn_set_lang(&syntax, syn_lang_for(currentPath, &buf), total_rows(&buf));
+                dirty = false;
+                disk = opened;
+                toast_set(&toast, "Opened", 1.0);
+            } else {
+                if (fresh) tabs_close(&tabs, tabs.active, back, &live);
+                toast_set(&toast, "Could not open file", 1.5);
+            }
+            tabChanged = true;
+        }
+
+        // Tabs stay put while a replace runs on the active text or an external
+        // dialog is up, since its result belongs to the tab that asked.
+        if (replace_running(&replaceJob) || atomic_load(&fileDialog.state) != DIALOG_IDLE) { tabNew = false; tabTo = tabClose = -1; }
+
+        // A tab with unsaved changes needs a second close within two seconds.
+        if (tabClose >= 0) {
+            bool unsaved = tabClose == tabs.active ? dirty : tabs.docs[tabClose].dirty;
+            if (unsaved && !(closeArmed == tabClose && GetTime() < closeArmedUntil)) {
+                closeArmed = tabClose;
+                closeArmedUntil = GetTime() + 2.0;
+                toast_set(&toast, "Unsaved changes: close again to discard", 2.0);
+            } else {
+                doc_load_note(&toast, tabs_close(&tabs, tabClose, -1, &live));
+                closeArmed = -1;
+                tabChanged = true;
+            }
+            tabTo = -1;
+        }
+        // So does quitting while any tab has them; the session keeps only
+        // paths, so the edits would be gone for good.
+        if (quitAsked) {
+            if (tabs_any_dirty(&tabs, dirty) && GetTime() >= quitArmedUntil) {
+                quitArmedUntil = GetTime() + 2.0;
+                toast_set(&toast, "Unsaved changes: quit again to discard", 2.0);
+            } else quitRequested = true;
+            quitAsked = false;
+        }
+        if (tabNew && tabs_push(&tabs)) tabTo = tabs.count - 1;
+        if (tabTo >= 0 && tabTo != tabs.active) {
+            doc_load_note(&toast, tabs_activate(&tabs, tabTo, &live));
+            tabChanged = true;
+        }
+        if (tabChanged) {
+            // Shared state that described the previous tab.
+            find_hits_free(&findBar);
+            findBar.jumpPending = false;
+            gotoBar.open = false;
+            mm_dirty(&minimap, 0, minimap.texH);
+            dragging = columnDrag = mmDragging = false;
+            prevCursor = buf.cursor;
+        }
+
+        // With this frame's tab changes in, inactive texts give memory back
+        // until the total fits the budget.
+        if (tabChanged || buf.version != liveBytesVersion) {
+            liveBytes = doc_bytes(&buf, &syntax, &carets);
+            liveBytesVersion = buf.version;
+        }
+        tabs_trim(&tabs, liveBytes);
+        if (picker.open && picker.result != PICK_NONE) picker_close(&picker);
+
         EndDrawing();
+
+        if (firstFrame) {
+            firstFrame = false;
+            startup_mark("first frame");
+            if (startupReport) startup_report();
+            if (quitAfterFirstFrame) quitRequested = true;
+        }
     }
 
+    // A dialog still up at exit is left to die with the process.
+    if (atomic_load(&fileDialog.state) == DIALOG_RUNNING) pthread_detach(fileDialog.thread);
+    dialog_probe_wait();
+    picker_free(&picker);
+    find_free(&findBar);
+    find_hits_free(&findBar);
+    replace_cancel(&replaceJob);
+    session_save(&tabs, &live);
+    tabs_free(&tabs);
+    carets_free(&carets);
+    dircache_free(&dirCache);
+    watch_free(&watch);
+    mm_free(&minimap);
+    syn_free(&syntax);
+    glyphs_free(&glyphs);
     UnloadFont(editorFont);
     if (uiFont.texture.id != editorFont.texture.id) UnloadFont(uiFont);
 
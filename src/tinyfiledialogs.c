@@ -2897,29 +2897,38 @@ static int dirExists ( char const * const aDirPath )
 }
 
 
+/* Pen: walks $PATH with access() instead of forking `which` for every probe
+   (altered from the original tinyfiledialogs source). */
 static int detectPresence ( char const * const aExecutable )
 {
-	char lBuff [MAX_PATH_OR_CMD] ;
-	char lTestedString [MAX_PATH_OR_CMD] = "which " ;
-	FILE * lIn ;
+	char lCandidate [MAX_PATH_OR_CMD] ;
+	char const * lPath ;
+	char const * lSep ;
+	size_t lLen ;
+	int lFound = 0 ;
 
-    strcat ( lTestedString , aExecutable ) ;
-	strcat( lTestedString, " 2>/dev/null ");
-    lIn = popen ( lTestedString , "r" ) ;
-    if ( ( fgets ( lBuff , sizeof ( lBuff ) , lIn ) != NULL )
-		&& ( ! strchr ( lBuff , ':' ) )
-		&& ( strncmp(lBuff, "no ", 3) ) )
-    {	/* present */
-    	pclose ( lIn ) ;
-	if (tinyfd_verbose) printf("detectPresence %s %d\n", aExecutable, 1);
-    	return 1 ;
-    }
-    else
-    {
-    	pclose ( lIn ) ;
-	if (tinyfd_verbose) printf("detectPresence %s %d\n", aExecutable, 0);
-    	return 0 ;
-    }
+	if ( strchr ( aExecutable , '/' ) )
+	{
+		lFound = ! access ( aExecutable , X_OK ) && ! dirExists ( aExecutable ) ;
+	}
+	else if ( ( lPath = getenv ( "PATH" ) ) )
+	{
+		while ( ! lFound && * lPath )
+		{
+			lSep = strchr ( lPath , ':' ) ;
+			lLen = lSep ? (size_t) ( lSep - lPath ) : strlen ( lPath ) ;
+			if ( lLen && lLen + strlen ( aExecutable ) + 2 < sizeof ( lCandidate ) )
+			{
+				memcpy ( lCandidate , lPath , lLen ) ;
+				lCandidate [lLen] = '/' ;
+				strcpy ( lCandidate + lLen + 1 , aExecutable ) ;
+				lFound = ! access ( lCandidate , X_OK ) && ! dirExists ( lCandidate ) ;
+			}
+			lPath += lLen + ( lSep ? 1 : 0 ) ;
+		}
+	}
+	if (tinyfd_verbose) printf("detectPresence %s %d\n", aExecutable, lFound);
+	return lFound ;
 }
 
 